@@ -0,0 +1,1039 @@
+/*
+ * GstCurlHttpSrc
+ * Copyright 2014 British Broadcasting Corporation - Research and Development
+ *
+ * Author: Sam Hurst <samuelh@rd.bbc.co.uk>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Alternatively, the contents of this file may be used under the
+ * GNU Lesser General Public License Version 2.1 (the "LGPL"), in
+ * which case the following provisions apply instead of the ones
+ * mentioned above:
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <glib/gstdio.h>
+
+#include "gstcurlcache.h"
+
+/*
+ * A process-wide cache of complete responses, so that instances fetching the
+ * same thing (init segments, manifests) don't each go back to the server for
+ * it. Only responses that say how long they stay fresh, through Cache-Control
+ * or Expires, are kept, and only for that long.
+ */
+
+static const gchar *
+gst_curl_http_src_cache_request_header (const GstStructure * request_headers,
+    const gchar * name)
+{
+  const gchar *field;
+  const GValue *value;
+  gint i;
+
+  if (request_headers == NULL) {
+    return NULL;
+  }
+
+  /* Header names are case insensitive, and request-headers is user supplied */
+  for (i = 0; i < gst_structure_n_fields (request_headers); i++) {
+    field = gst_structure_nth_field_name (request_headers, i);
+    if (g_ascii_strcasecmp (field, name) == 0) {
+      value = gst_structure_get_value (request_headers, field);
+      return G_VALUE_HOLDS_STRING (value) ? g_value_get_string (value) : NULL;
+    }
+  }
+
+  return NULL;
+}
+
+/*
+ * Parse an HTTP date, e.g. "Sun, 06 Nov 1994 08:49:37 GMT", into seconds
+ * since the epoch. Returns -1 if it can't be parsed, which as far as Expires
+ * is concerned means it has already expired.
+ */
+static gint64
+gst_curl_http_src_cache_parse_date (const gchar * date)
+{
+  static const gchar months[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+  gchar month[4];
+  const gchar *found;
+  gint day, year, hour, minute, second;
+  GDateTime *datetime;
+  gint64 seconds;
+
+  if ((date == NULL) || (sscanf (date, "%*[^,], %d %3s %d %d:%d:%d", &day,
+              month, &year, &hour, &minute, &second) != 6)) {
+    return -1;
+  }
+  found = strstr (months, month);
+  if ((strlen (month) != 3) || (found == NULL) || ((found - months) % 3)) {
+    return -1;
+  }
+
+  datetime = g_date_time_new_utc (year, ((found - months) / 3) + 1, day, hour,
+      minute, second);
+  if (datetime == NULL) {
+    return -1;
+  }
+  seconds = g_date_time_to_unix (datetime);
+  g_date_time_unref (datetime);
+
+  return seconds;
+}
+
+static void
+gst_curl_http_src_cache_free_entry (GstCurlHttpSrcCacheEntry * entry)
+{
+  g_free (entry->uri);
+  gst_structure_free (entry->vary);
+  gst_structure_free (entry->headers);
+  gst_buffer_unref (entry->body);
+  g_free (entry);
+}
+
+/*
+ * Drop an entry from the cache. Called with the response_cache_mutex held.
+ */
+static void
+gst_curl_http_src_cache_remove (GstCurlHttpSrcClass * klass,
+    GstCurlHttpSrcCacheEntry * entry)
+{
+  g_hash_table_remove (klass->response_cache, entry->uri);
+  g_queue_unlink (&klass->response_cache_lru, &entry->lru_link);
+  klass->response_cache_size -= gst_buffer_get_size (entry->body);
+  gst_curl_http_src_cache_free_entry (entry);
+}
+
+/*
+ * Note down the request headers a response varies on, as they were sent.
+ */
+static GstStructure *
+gst_curl_http_src_cache_vary (const GstStructure * headers,
+    const GstStructure * request_headers)
+{
+  GstStructure *vary;
+  const gchar *value;
+  gchar **names;
+  guint i;
+
+  vary = gst_structure_new_empty ("vary");
+  value = gst_structure_get_string (headers, "vary");
+  if (value != NULL) {
+    names = g_strsplit (value, ",", -1);
+    for (i = 0; names[i] != NULL; i++) {
+      gchar *name = g_ascii_strdown (g_strstrip (names[i]), -1);
+      if (*name != '\0') {
+        const gchar *sent = gst_curl_http_src_cache_request_header
+            (request_headers, name);
+        gst_structure_set (vary, name, G_TYPE_STRING,
+            (sent != NULL) ? sent : "", NULL);
+      }
+      g_free (name);
+    }
+    g_strfreev (names);
+  }
+
+  return vary;
+}
+
+/*
+ * Does the request we're about to make match the one a response was for, as
+ * far as the headers the response varied on are concerned?
+ */
+static gboolean
+gst_curl_http_src_cache_vary_matches (const GstStructure * vary,
+    const GstStructure * request_headers)
+{
+  const gchar *name, *value;
+  gint i;
+
+  for (i = 0; i < gst_structure_n_fields (vary); i++) {
+    name = gst_structure_nth_field_name (vary, i);
+    value = gst_curl_http_src_cache_request_header (request_headers, name);
+    if (g_strcmp0 ((value != NULL) ? value : "",
+            gst_structure_get_string (vary, name)) != 0) {
+      return FALSE;
+    }
+  }
+
+  return TRUE;
+}
+
+/*
+ * Is a Cache-Control directive private, i.e. for one user only? Field names
+ * given with it aren't picked out; the whole response is kept private.
+ */
+static gboolean
+gst_curl_http_src_cache_is_private (const gchar * directive)
+{
+  return (g_ascii_strncasecmp (directive, "private", 7) == 0) &&
+      ((directive[7] == '\0') || (directive[7] == '='));
+}
+
+/**
+ * Set up the cache, with a budget in bytes taken from the
+ * GST_CURL_RESPONSE_CACHE_SIZE environment variable if it's set.
+ * @param klass The class the cache belongs to.
+ */
+void
+gst_curl_http_src_cache_init (GstCurlHttpSrcClass * klass)
+{
+  const gchar *size_env;
+
+  g_mutex_init (&klass->response_cache_mutex);
+  klass->response_cache = g_hash_table_new (g_str_hash, g_str_equal);
+  g_queue_init (&klass->response_cache_lru);
+  klass->response_cache_size = 0;
+  klass->response_cache_budget = GSTCURL_DEFAULT_RESPONSE_CACHE_SIZE;
+
+  size_env = g_getenv ("GST_CURL_RESPONSE_CACHE_SIZE");
+  if (size_env != NULL) {
+    klass->response_cache_budget = (gsize) g_ascii_strtoull (size_env, NULL,
+        10);
+  }
+}
+
+/**
+ * Work out how long a response can be kept for from its headers.
+ * @param headers The response headers.
+ * @return Returns the number of seconds it stays fresh for, or 0 if it
+ * mustn't be cached at all.
+ */
+gint64
+gst_curl_http_src_cache_lifetime (const GstStructure * headers)
+{
+  const gchar *value;
+  gchar **fields;
+  gint64 max_age = -1, s_max_age = -1, lifetime, date, expires;
+  gboolean store = TRUE;
+  guint i;
+
+  /* A response that varies on everything can't be matched up again */
+  value = gst_structure_get_string (headers, "vary");
+  if ((value != NULL) && (strchr (value, '*') != NULL)) {
+    return 0;
+  }
+
+  value = gst_structure_get_string (headers, "cache-control");
+  if (value != NULL) {
+    fields = g_strsplit (value, ",", -1);
+    for (i = 0; fields[i] != NULL; i++) {
+      gchar *directive = g_strstrip (fields[i]);
+      if ((g_ascii_strcasecmp (directive, "no-store") == 0) ||
+          (g_ascii_strcasecmp (directive, "no-cache") == 0) ||
+          gst_curl_http_src_cache_is_private (directive)) {
+        store = FALSE;
+      } else if (g_ascii_strncasecmp (directive, "s-maxage=", 9) == 0) {
+        s_max_age = g_ascii_strtoll (directive + 9, NULL, 10);
+      } else if (g_ascii_strncasecmp (directive, "max-age=", 8) == 0) {
+        max_age = g_ascii_strtoll (directive + 8, NULL, 10);
+      }
+    }
+    g_strfreev (fields);
+  }
+  if (store == FALSE) {
+    return 0;
+  }
+
+  /* We're shared between pipelines, so s-maxage wins */
+  if (s_max_age >= 0) {
+    lifetime = s_max_age;
+  } else if (max_age >= 0) {
+    lifetime = max_age;
+  } else {
+    value = gst_structure_get_string (headers, "expires");
+    if (value == NULL) {
+      return 0;
+    }
+    expires = gst_curl_http_src_cache_parse_date (value);
+    date = gst_curl_http_src_cache_parse_date (gst_structure_get_string
+        (headers, "date"));
+    if (date < 0) {
+      date = g_get_real_time () / G_USEC_PER_SEC;
+    }
+    lifetime = expires - date;
+  }
+
+  /* However long it has already spent in other caches is used up */
+  value = gst_structure_get_string (headers, "age");
+  if (value != NULL) {
+    lifetime -= g_ascii_strtoll (value, NULL, 10);
+  }
+
+  return MAX (lifetime, 0);
+}
+
+/**
+ * Whether a response may go in a cache shared with other users, i.e. other
+ * elements or processes, rather than only ever go back to whoever asked for
+ * it. One to a request that carried credentials or cookies has to say so.
+ * @param headers The response headers.
+ * @param authenticated Whether the request carried credentials or cookies.
+ * @return Returns TRUE if the response can be shared.
+ */
+gboolean
+gst_curl_http_src_cache_shareable (const GstStructure * headers,
+    gboolean authenticated)
+{
+  const gchar *value;
+  gchar **fields;
+  gboolean shareable = !authenticated;
+  guint i;
+
+  value = gst_structure_get_string (headers, "cache-control");
+  if (value == NULL) {
+    return shareable;
+  }
+
+  fields = g_strsplit (value, ",", -1);
+  for (i = 0; fields[i] != NULL; i++) {
+    gchar *directive = g_strstrip (fields[i]);
+    if (gst_curl_http_src_cache_is_private (directive)) {
+      shareable = FALSE;
+      break;
+    }
+    if ((g_ascii_strcasecmp (directive, "public") == 0) ||
+        (g_ascii_strncasecmp (directive, "s-maxage=", 9) == 0)) {
+      shareable = TRUE;
+    }
+  }
+  g_strfreev (fields);
+
+  return shareable;
+}
+
+/**
+ * Whether a response can be kept to check back with the server about once
+ * it's stale, whether or not it's fresh to begin with.
+ * @param headers The response headers.
+ * @return Returns TRUE if it has a validator and storing it is allowed.
+ */
+gboolean
+gst_curl_http_src_cache_revalidatable (const GstStructure * headers)
+{
+  const gchar *value;
+  gchar **fields;
+  gboolean store = TRUE;
+  guint i;
+
+  value = gst_structure_get_string (headers, "vary");
+  if ((value != NULL) && (strchr (value, '*') != NULL)) {
+    return FALSE;
+  }
+
+  value = gst_structure_get_string (headers, "cache-control");
+  if (value != NULL) {
+    fields = g_strsplit (value, ",", -1);
+    for (i = 0; fields[i] != NULL; i++) {
+      if (g_ascii_strcasecmp (g_strstrip (fields[i]), "no-store") == 0) {
+        store = FALSE;
+      }
+    }
+    g_strfreev (fields);
+  }
+
+  return (store == TRUE) &&
+      (gst_structure_has_field (headers, "etag") ||
+      gst_structure_has_field (headers, "last-modified"));
+}
+
+/**
+ * Find a fresh response for a URI.
+ * @param klass The class the cache belongs to.
+ * @param uri The URI about to be fetched.
+ * @param request_headers The extra headers the request would have gone with.
+ * @param headers Set to a copy of the response headers on a hit.
+ * @param body Set to a reference to the response body on a hit.
+ * @return Returns TRUE on a hit.
+ */
+gboolean
+gst_curl_http_src_cache_lookup (GstCurlHttpSrcClass * klass,
+    const gchar * uri, const GstStructure * request_headers,
+    GstStructure ** headers, GstBuffer ** body)
+{
+  GstCurlHttpSrcCacheEntry *entry;
+
+  if (uri == NULL) {
+    return FALSE;
+  }
+
+  g_mutex_lock (&klass->response_cache_mutex);
+  entry = g_hash_table_lookup (klass->response_cache, uri);
+  if ((entry != NULL) && (entry->expires <= g_get_monotonic_time ())) {
+    gst_curl_http_src_cache_remove (klass, entry);
+    entry = NULL;
+  }
+  if ((entry == NULL) ||
+      (gst_curl_http_src_cache_vary_matches (entry->vary, request_headers) ==
+          FALSE)) {
+    g_mutex_unlock (&klass->response_cache_mutex);
+    return FALSE;
+  }
+
+  g_queue_unlink (&klass->response_cache_lru, &entry->lru_link);
+  g_queue_push_head_link (&klass->response_cache_lru, &entry->lru_link);
+  *headers = gst_structure_copy (entry->headers);
+  *body = gst_buffer_ref (entry->body);
+  g_mutex_unlock (&klass->response_cache_mutex);
+
+  return TRUE;
+}
+
+/**
+ * Keep a complete response, replacing whatever was there for the URI and
+ * making room for it by dropping the least recently used responses.
+ * @param klass The class the cache belongs to.
+ * @param uri The URI the response was for.
+ * @param request_headers The extra headers the request went with.
+ * @param headers The response headers.
+ * @param body The response body, which the cache takes a reference to.
+ * @param lifetime How long it stays fresh for, from
+ * gst_curl_http_src_cache_lifetime().
+ */
+void
+gst_curl_http_src_cache_insert (GstCurlHttpSrcClass * klass,
+    const gchar * uri, const GstStructure * request_headers,
+    const GstStructure * headers, GstBuffer * body, gint64 lifetime)
+{
+  GstCurlHttpSrcCacheEntry *entry, *old;
+
+  if ((lifetime <= 0) ||
+      (gst_buffer_get_size (body) > klass->response_cache_budget)) {
+    return;
+  }
+
+  entry = g_new0 (GstCurlHttpSrcCacheEntry, 1);
+  entry->uri = g_strdup (uri);
+  entry->headers = gst_structure_copy (headers);
+  entry->body = gst_buffer_ref (body);
+  entry->expires = g_get_monotonic_time () + (lifetime * G_USEC_PER_SEC);
+  entry->lru_link.data = entry;
+  entry->vary = gst_curl_http_src_cache_vary (headers, request_headers);
+
+  g_mutex_lock (&klass->response_cache_mutex);
+  old = g_hash_table_lookup (klass->response_cache, uri);
+  if (old != NULL) {
+    gst_curl_http_src_cache_remove (klass, old);
+  }
+  g_hash_table_insert (klass->response_cache, entry->uri, entry);
+  g_queue_push_head_link (&klass->response_cache_lru, &entry->lru_link);
+  klass->response_cache_size += gst_buffer_get_size (body);
+
+  while (klass->response_cache_size > klass->response_cache_budget) {
+    old = g_queue_peek_tail (&klass->response_cache_lru);
+    gst_curl_http_src_cache_remove (klass, old);
+  }
+  g_mutex_unlock (&klass->response_cache_mutex);
+}
+
+/*
+ * An element's own list of the responses it has had with validators, see the
+ * revalidate property. There are only ever a few of them, so they're simply
+ * kept in order of use, and looked through one by one.
+ */
+
+/**
+ * Find the last response for a URI in a list of validated responses,
+ * however old it is.
+ * @param entries The list of validated responses.
+ * @param uri The URI about to be fetched.
+ * @param request_headers The extra headers the request would have gone with.
+ * @param headers Set to a copy of the response headers if found.
+ * @param body Set to a reference to the response body if found.
+ * @return Returns TRUE if found.
+ */
+gboolean
+gst_curl_http_src_cache_recall (GQueue * entries, const gchar * uri,
+    const GstStructure * request_headers, GstStructure ** headers,
+    GstBuffer ** body)
+{
+  GstCurlHttpSrcCacheEntry *entry;
+  GList *link;
+
+  for (link = entries->head; link != NULL; link = link->next) {
+    entry = link->data;
+    if ((g_strcmp0 (entry->uri, uri) == 0) &&
+        (gst_curl_http_src_cache_vary_matches (entry->vary,
+                request_headers) == TRUE)) {
+      g_queue_unlink (entries, link);
+      g_queue_push_head_link (entries, link);
+      *headers = gst_structure_copy (entry->headers);
+      *body = gst_buffer_ref (entry->body);
+      return TRUE;
+    }
+  }
+
+  return FALSE;
+}
+
+/**
+ * Add a response to a list of validated responses, in place of any earlier
+ * one for the URI, dropping the least recently used if the list is full.
+ * @param entries The list of validated responses.
+ * @param max_entries How many responses the list holds.
+ * @param uri The URI the response was for.
+ * @param request_headers The extra headers the request went with.
+ * @param headers The response headers.
+ * @param body The response body, which the list takes a reference to.
+ */
+void
+gst_curl_http_src_cache_remember (GQueue * entries, guint max_entries,
+    const gchar * uri, const GstStructure * request_headers,
+    const GstStructure * headers, GstBuffer * body)
+{
+  GstCurlHttpSrcCacheEntry *entry;
+  GList *link, *next;
+
+  for (link = entries->head; link != NULL; link = next) {
+    next = link->next;
+    entry = link->data;
+    if (g_strcmp0 (entry->uri, uri) == 0) {
+      g_queue_unlink (entries, link);
+      gst_curl_http_src_cache_free_entry (entry);
+    }
+  }
+
+  entry = g_new0 (GstCurlHttpSrcCacheEntry, 1);
+  entry->uri = g_strdup (uri);
+  entry->vary = gst_curl_http_src_cache_vary (headers, request_headers);
+  entry->headers = gst_structure_copy (headers);
+  entry->body = gst_buffer_ref (body);
+  entry->lru_link.data = entry;
+  g_queue_push_head_link (entries, &entry->lru_link);
+
+  while (entries->length > max_entries) {
+    link = g_queue_pop_tail_link (entries);
+    gst_curl_http_src_cache_free_entry (link->data);
+  }
+}
+
+/**
+ * Empty a list of validated responses.
+ * @param entries The list of validated responses.
+ */
+void
+gst_curl_http_src_cache_forget (GQueue * entries)
+{
+  GList *link;
+
+  while ((link = g_queue_pop_head_link (entries)) != NULL) {
+    gst_curl_http_src_cache_free_entry (link->data);
+  }
+}
+
+/*
+ * The on-disk cache, see the cache-directory property. Each response is kept
+ * in two files: the body just as it came, so that it can be mapped straight
+ * into buffers, and a serialised GstStructure with its headers, the name of
+ * its body and whatever else it takes to decide if it can be used. The
+ * metadata is named after a hash of the URI, and each body gets a name of its
+ * own starting with the same hash, so a new one never takes the place of one
+ * that's in use. The body goes in first and the metadata is renamed into
+ * place last, so instances in other processes sharing the directory never see
+ * half of a response, nor headers with the wrong body.
+ */
+
+typedef struct
+{
+  gchar *base;                  /* Path of the metadata, without the suffix */
+  gchar *body;
+  guint64 size;
+  gint64 used;                  /* When the metadata was last touched */
+} GstCurlHttpSrcDiskCacheFile;
+
+/*
+ * How many bytes of bodies each directory holds, as far as this process
+ * knows, so it only has to go through one when it may have grown too big.
+ * Other processes sharing it aren't counted until it's next pruned.
+ */
+static GMutex disk_cache_sizes_mutex;
+static GHashTable *disk_cache_sizes;    /* Directory to guint64 */
+
+static gchar *
+gst_curl_http_src_disk_cache_path (const gchar * directory, const gchar * uri,
+    const gchar * suffix)
+{
+  gchar *key, *name, *path;
+
+  key = g_compute_checksum_for_string (G_CHECKSUM_SHA256, uri, -1);
+  name = g_strconcat (key, suffix, NULL);
+  path = g_build_filename (directory, name, NULL);
+  g_free (name);
+  g_free (key);
+
+  return path;
+}
+
+static gboolean
+gst_curl_http_src_disk_cache_write_meta (const gchar * directory,
+    const gchar * uri, const gchar * body,
+    const GstStructure * request_headers, const GstStructure * headers,
+    gsize size, gint64 lifetime)
+{
+  GstStructure *meta, *vary;
+  gchar *path, *contents;
+  gboolean ret;
+
+  vary = gst_curl_http_src_cache_vary (headers, request_headers);
+  meta = gst_structure_new ("curlhttpsrc-cache",
+      "uri", G_TYPE_STRING, uri,
+      "body", G_TYPE_STRING, body,
+      "size", G_TYPE_UINT64, (guint64) size,
+      "expires", G_TYPE_INT64, (g_get_real_time () / G_USEC_PER_SEC) + lifetime,
+      "vary", GST_TYPE_STRUCTURE, vary,
+      "headers", GST_TYPE_STRUCTURE, headers, NULL);
+  contents = gst_structure_to_string (meta);
+  path = gst_curl_http_src_disk_cache_path (directory, uri, ".meta");
+  ret = g_file_set_contents (path, contents, -1, NULL);
+  g_free (path);
+  g_free (contents);
+  gst_structure_free (meta);
+  gst_structure_free (vary);
+
+  return ret;
+}
+
+/*
+ * Read the metadata kept for a URI, or NULL if there's none. Different URIs
+ * could still hash the same, so that's left to the caller to check.
+ */
+static GstStructure *
+gst_curl_http_src_disk_cache_read_meta (const gchar * directory,
+    const gchar * uri)
+{
+  GstStructure *meta;
+  gchar *path, *contents;
+
+  path = gst_curl_http_src_disk_cache_path (directory, uri, ".meta");
+  if (g_file_get_contents (path, &contents, NULL, NULL) == FALSE) {
+    g_free (path);
+    return NULL;
+  }
+  g_free (path);
+  meta = gst_structure_from_string (contents, NULL);
+  g_free (contents);
+
+  return meta;
+}
+
+/*
+ * The name of the body the metadata goes with, or NULL if it doesn't say or
+ * names something outside the directory.
+ */
+static const gchar *
+gst_curl_http_src_disk_cache_meta_body (const GstStructure * meta)
+{
+  const gchar *body = gst_structure_get_string (meta, "body");
+
+  if ((body == NULL) || (strchr (body, G_DIR_SEPARATOR) != NULL) ||
+      (g_str_has_suffix (body, ".body") == FALSE)) {
+    return NULL;
+  }
+  return body;
+}
+
+static gint
+gst_curl_http_src_disk_cache_compare (gconstpointer a, gconstpointer b)
+{
+  const GstCurlHttpSrcDiskCacheFile *file_a = a;
+  const GstCurlHttpSrcDiskCacheFile *file_b = b;
+
+  return (file_a->used > file_b->used) - (file_a->used < file_b->used);
+}
+
+/*
+ * Get the directory down to max_size bytes of bodies, dropping the least
+ * recently used responses first. Returns how many bytes of bodies are left.
+ */
+static guint64
+gst_curl_http_src_disk_cache_prune (const gchar * directory,
+    guint64 max_size)
+{
+  GstCurlHttpSrcDiskCacheFile *file;
+  GList *files = NULL, *link;
+  guint64 total = 0;
+  const gchar *name;
+  gchar *path, *key;
+  GStatBuf st;
+  GDir *dir;
+
+  dir = g_dir_open (directory, 0, NULL);
+  if (dir == NULL) {
+    return 0;
+  }
+  while ((name = g_dir_read_name (dir)) != NULL) {
+    if (g_str_has_suffix (name, ".body") == FALSE) {
+      continue;
+    }
+    path = g_build_filename (directory, name, NULL);
+    if (g_stat (path, &st) == 0) {
+      /* Bodies start with the hash their metadata is named after */
+      file = g_new0 (GstCurlHttpSrcDiskCacheFile, 1);
+      key = g_strndup (name, strcspn (name, "."));
+      file->base = g_build_filename (directory, key, NULL);
+      g_free (key);
+      file->body = path;
+      file->size = st.st_size;
+      total += file->size;
+
+      /* A body without its metadata is no use to anyone, so it goes first */
+      path = g_strconcat (file->base, ".meta", NULL);
+      file->used = (g_stat (path, &st) == 0) ? st.st_mtime : 0;
+      files = g_list_prepend (files, file);
+    }
+    g_free (path);
+  }
+  g_dir_close (dir);
+
+  files = g_list_sort (files, gst_curl_http_src_disk_cache_compare);
+  for (link = files; link != NULL; link = link->next) {
+    file = link->data;
+    if (total > max_size) {
+      path = g_strconcat (file->base, ".meta", NULL);
+      g_unlink (path);
+      g_free (path);
+      g_unlink (file->body);
+      total -= file->size;
+    }
+    g_free (file->base);
+    g_free (file->body);
+    g_free (file);
+  }
+  g_list_free (files);
+
+  return total;
+}
+
+/*
+ * Count another size bytes of body into the directory, and prune it if that
+ * takes it over max_size. The first time round the directory is pruned
+ * anyway, to find out how much it already holds.
+ */
+static void
+gst_curl_http_src_disk_cache_grow (const gchar * directory, guint64 max_size,
+    guint64 size)
+{
+  guint64 *total;
+
+  g_mutex_lock (&disk_cache_sizes_mutex);
+  if (disk_cache_sizes == NULL) {
+    disk_cache_sizes = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+        g_free);
+  }
+  total = g_hash_table_lookup (disk_cache_sizes, directory);
+  if (total == NULL) {
+    total = g_new (guint64, 1);
+    *total = gst_curl_http_src_disk_cache_prune (directory, max_size);
+    g_hash_table_insert (disk_cache_sizes, g_strdup (directory), total);
+  } else {
+    /* Replacing a response counts it twice, which the next prune puts right */
+    *total += size;
+    if (*total > max_size) {
+      *total = gst_curl_http_src_disk_cache_prune (directory, max_size);
+    }
+  }
+  g_mutex_unlock (&disk_cache_sizes_mutex);
+}
+
+/**
+ * Find a response for a URI in a cache directory, fresh or not.
+ * @param directory The cache directory.
+ * @param uri The URI about to be fetched.
+ * @param request_headers The extra headers the request would have gone with.
+ * @param headers Set to the response headers on a hit.
+ * @param body Set to a buffer mapping the response body on a hit.
+ * @param fresh Set to whether the response can be used as it is, rather than
+ * having to be revalidated first.
+ * @return Returns TRUE on a hit.
+ */
+gboolean
+gst_curl_http_src_disk_cache_lookup (const gchar * directory,
+    const gchar * uri, const GstStructure * request_headers,
+    GstStructure ** headers, GstBuffer ** body, gboolean * fresh)
+{
+  GstStructure *meta;
+  const GValue *vary, *stored;
+  const gchar *name;
+  GMappedFile *mapped = NULL;
+  gchar *path, *contents;
+  guint64 size;
+  gint64 expires;
+  gboolean ret = FALSE;
+
+  if (uri == NULL) {
+    return FALSE;
+  }
+
+  meta = gst_curl_http_src_disk_cache_read_meta (directory, uri);
+  if (meta == NULL) {
+    return FALSE;
+  }
+  path = gst_curl_http_src_disk_cache_path (directory, uri, ".meta");
+
+  /* Different URIs could still hash the same */
+  vary = gst_structure_get_value (meta, "vary");
+  stored = gst_structure_get_value (meta, "headers");
+  name = gst_curl_http_src_disk_cache_meta_body (meta);
+  if ((g_strcmp0 (gst_structure_get_string (meta, "uri"), uri) != 0) ||
+      (name == NULL) ||
+      (gst_structure_get_uint64 (meta, "size", &size) == FALSE) ||
+      (gst_structure_get_int64 (meta, "expires", &expires) == FALSE) ||
+      (vary == NULL) || (GST_VALUE_HOLDS_STRUCTURE (vary) == FALSE) ||
+      (stored == NULL) || (GST_VALUE_HOLDS_STRUCTURE (stored) == FALSE) ||
+      (gst_curl_http_src_cache_vary_matches (gst_value_get_structure (vary),
+              request_headers) == FALSE)) {
+    goto out;
+  }
+
+  /* Mapping keeps the body around even once a newer one replaces it */
+  contents = g_build_filename (directory, name, NULL);
+  mapped = g_mapped_file_new (contents, FALSE, NULL);
+  g_free (contents);
+  if ((mapped == NULL) || (size == 0) ||
+      (g_mapped_file_get_length (mapped) != size)) {
+    goto out;
+  }
+
+  *body = gst_buffer_new ();
+  gst_buffer_append_memory (*body,
+      gst_memory_new_wrapped (GST_MEMORY_FLAG_READONLY,
+          g_mapped_file_get_contents (mapped), size, 0, size,
+          g_mapped_file_ref (mapped), (GDestroyNotify) g_mapped_file_unref));
+  *headers = gst_structure_copy (gst_value_get_structure (stored));
+  *fresh = (expires > (g_get_real_time () / G_USEC_PER_SEC));
+
+  /* Pruning goes by when the metadata was last touched */
+  g_utime (path, NULL);
+  ret = TRUE;
+
+out:
+  if (mapped != NULL) {
+    g_mapped_file_unref (mapped);
+  }
+  gst_structure_free (meta);
+  g_free (path);
+
+  return ret;
+}
+
+/**
+ * Start writing a response body into a cache directory. It goes into a file
+ * of its own, which only takes the place of whatever was there before once
+ * it's complete, see gst_curl_http_src_disk_cache_commit().
+ * @param directory The cache directory, which is created if need be.
+ * @param uri The URI the response is for.
+ * @param file Set to the name of the temporary file, which the caller frees.
+ * @return Returns a descriptor to write the body to, or -1 on failure.
+ */
+gint
+gst_curl_http_src_disk_cache_begin (const gchar * directory, const gchar * uri,
+    gchar ** file)
+{
+  gint fd;
+
+  *file = NULL;
+  if ((uri == NULL) || (g_mkdir_with_parents (directory, 0755) != 0)) {
+    return -1;
+  }
+
+  /* Without the .body suffix until it's done, so pruning leaves it alone */
+  *file = gst_curl_http_src_disk_cache_path (directory, uri, ".XXXXXX");
+  fd = g_mkstemp (*file);
+  if (fd < 0) {
+    g_free (*file);
+    *file = NULL;
+  }
+
+  return fd;
+}
+
+/**
+ * Add the next buffer of a response body to its temporary file.
+ * @param fd The descriptor from gst_curl_http_src_disk_cache_begin().
+ * @param buf The buffer to write.
+ * @return Returns FALSE if it couldn't all be written.
+ */
+gboolean
+gst_curl_http_src_disk_cache_write (gint fd, GstBuffer * buf)
+{
+  GstMapInfo map;
+  gsize done = 0;
+  gssize written;
+  gboolean ret = TRUE;
+
+  if (gst_buffer_map (buf, &map, GST_MAP_READ) == FALSE) {
+    return FALSE;
+  }
+  while (done < map.size) {
+    written = write (fd, map.data + done, map.size - done);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      ret = FALSE;
+      break;
+    }
+    done += written;
+  }
+  gst_buffer_unmap (buf, &map);
+
+  return ret;
+}
+
+/**
+ * Finish writing a response into a cache directory, replacing whatever was
+ * there for the URI, and then make room for it if the directory has grown
+ * past max_size. The body gets its final name first, and the metadata naming
+ * it going in is what commits the response. The body it replaced goes after
+ * that; anyone who already has it mapped keeps it until they're done.
+ * @param directory The cache directory.
+ * @param max_size The most bytes of bodies to keep in the directory.
+ * @param uri The URI the response was for.
+ * @param request_headers The extra headers the request went with.
+ * @param headers The response headers.
+ * @param fd The descriptor the body was written to, which is closed.
+ * @param file The temporary file the body was written to.
+ * @param size The size of the body.
+ * @param lifetime How long it stays fresh for, from
+ * gst_curl_http_src_cache_lifetime(). It can be 0 for a response that is
+ * always revalidated.
+ * @return Returns FALSE if the response couldn't be stored.
+ */
+gboolean
+gst_curl_http_src_disk_cache_commit (const gchar * directory,
+    guint64 max_size, const gchar * uri, const GstStructure * request_headers,
+    const GstStructure * headers, gint fd, const gchar * file, guint64 size,
+    gint64 lifetime)
+{
+  GstStructure *meta;
+  const gchar *old;
+  gchar *body, *name, *path;
+
+  if (g_close (fd, NULL) == FALSE) {
+    g_unlink (file);
+    return FALSE;
+  }
+  body = g_strconcat (file, ".body", NULL);
+  if (g_rename (file, body) != 0) {
+    g_unlink (file);
+    g_free (body);
+    return FALSE;
+  }
+
+  meta = gst_curl_http_src_disk_cache_read_meta (directory, uri);
+  name = g_path_get_basename (body);
+  if (gst_curl_http_src_disk_cache_write_meta (directory, uri, name,
+          request_headers, headers, size, lifetime) == FALSE) {
+    g_unlink (body);
+    g_free (name);
+    g_free (body);
+    if (meta != NULL) {
+      gst_structure_free (meta);
+    }
+    return FALSE;
+  }
+
+  /* Only the same URI's body is ours to get rid of */
+  if ((meta != NULL) &&
+      (g_strcmp0 (gst_structure_get_string (meta, "uri"), uri) == 0)) {
+    old = gst_curl_http_src_disk_cache_meta_body (meta);
+    if ((old != NULL) && (g_strcmp0 (old, name) != 0)) {
+      path = g_build_filename (directory, old, NULL);
+      g_unlink (path);
+      g_free (path);
+    }
+  }
+  if (meta != NULL) {
+    gst_structure_free (meta);
+  }
+  g_free (name);
+  g_free (body);
+
+  gst_curl_http_src_disk_cache_grow (directory, max_size, size);
+  return TRUE;
+}
+
+/**
+ * Throw away a response body that was on its way into a cache directory.
+ * @param fd The descriptor the body was being written to, which is closed.
+ * @param file The temporary file the body was being written to.
+ */
+void
+gst_curl_http_src_disk_cache_abandon (gint fd, const gchar * file)
+{
+  g_close (fd, NULL);
+  g_unlink (file);
+}
+
+/**
+ * Bring a response in a cache directory up to date after the server has said
+ * that it hasn't changed. The body stays as it is.
+ * @param directory The cache directory.
+ * @param uri The URI the response was for.
+ * @param request_headers The extra headers the request went with.
+ * @param headers The response headers, updated with those from the server.
+ * @param size The size of the body.
+ * @param lifetime How long it stays fresh for from now.
+ * @return Returns FALSE if the response couldn't be written.
+ */
+gboolean
+gst_curl_http_src_disk_cache_refresh (const gchar * directory,
+    const gchar * uri, const GstStructure * request_headers,
+    const GstStructure * headers, gsize size, gint64 lifetime)
+{
+  GstStructure *meta;
+  const gchar *body;
+  gboolean ret = FALSE;
+
+  /* The body stays where the metadata already says it is */
+  meta = gst_curl_http_src_disk_cache_read_meta (directory, uri);
+  if (meta == NULL) {
+    return FALSE;
+  }
+  body = gst_curl_http_src_disk_cache_meta_body (meta);
+  if ((body != NULL) &&
+      (g_strcmp0 (gst_structure_get_string (meta, "uri"), uri) == 0)) {
+    ret = gst_curl_http_src_disk_cache_write_meta (directory, uri, body,
+        request_headers, headers, size, lifetime);
+  }
+  gst_structure_free (meta);
+
+  return ret;
+}
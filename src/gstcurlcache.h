@@ -0,0 +1,103 @@
+/*
+ * GstCurlHttpSrc
+ * Copyright 2014 British Broadcasting Corporation - Research and Development
+ *
+ * Author: Sam Hurst <samuelh@rd.bbc.co.uk>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Alternatively, the contents of this file may be used under the
+ * GNU Lesser General Public License Version 2.1 (the "LGPL"), in
+ * which case the following provisions apply instead of the ones
+ * mentioned above:
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+
+#ifndef GSTCURLCACHE_H_
+#define GSTCURLCACHE_H_
+
+#include "gstcurlhttpsrc.h"
+
+typedef struct _GstCurlHttpSrcCacheEntry GstCurlHttpSrcCacheEntry;
+
+/*
+ * A complete response in the process-wide cache. Entries are only touched with
+ * the class's response_cache_mutex held, and are never handed out: lookups
+ * get a reference to the body and a copy of the headers instead. An element's
+ * list of validated responses is made of the same entries, without expiry.
+ */
+struct _GstCurlHttpSrcCacheEntry
+{
+  gchar *uri;
+  GstStructure *vary;           /* Request headers named by Vary, lower case */
+  GstStructure *headers;        /* Response headers, as in http-headers */
+  GstBuffer *body;
+  gint64 expires;               /* Monotonic time it goes stale */
+  GList lru_link;               /* In response_cache_lru, or validated */
+};
+
+void gst_curl_http_src_cache_init (GstCurlHttpSrcClass *klass);
+gint64 gst_curl_http_src_cache_lifetime (const GstStructure *headers);
+gboolean gst_curl_http_src_cache_lookup (GstCurlHttpSrcClass *klass,
+    const gchar *uri, const GstStructure *request_headers,
+    GstStructure **headers, GstBuffer **body);
+void gst_curl_http_src_cache_insert (GstCurlHttpSrcClass *klass,
+    const gchar *uri, const GstStructure *request_headers,
+    const GstStructure *headers, GstBuffer *body, gint64 lifetime);
+gboolean gst_curl_http_src_cache_shareable (const GstStructure *headers,
+    gboolean authenticated);
+gboolean gst_curl_http_src_cache_revalidatable (const GstStructure *headers);
+gboolean gst_curl_http_src_cache_recall (GQueue *entries, const gchar *uri,
+    const GstStructure *request_headers, GstStructure **headers,
+    GstBuffer **body);
+void gst_curl_http_src_cache_remember (GQueue *entries, guint max_entries,
+    const gchar *uri, const GstStructure *request_headers,
+    const GstStructure *headers, GstBuffer *body);
+void gst_curl_http_src_cache_forget (GQueue *entries);
+gboolean gst_curl_http_src_disk_cache_lookup (const gchar *directory,
+    const gchar *uri, const GstStructure *request_headers,
+    GstStructure **headers, GstBuffer **body, gboolean *fresh);
+gint gst_curl_http_src_disk_cache_begin (const gchar *directory,
+    const gchar *uri, gchar **file);
+gboolean gst_curl_http_src_disk_cache_write (gint fd, GstBuffer *buf);
+gboolean gst_curl_http_src_disk_cache_commit (const gchar *directory,
+    guint64 max_size, const gchar *uri, const GstStructure *request_headers,
+    const GstStructure *headers, gint fd, const gchar *file, guint64 size,
+    gint64 lifetime);
+void gst_curl_http_src_disk_cache_abandon (gint fd, const gchar *file);
+gboolean gst_curl_http_src_disk_cache_refresh (const gchar *directory,
+    const gchar *uri, const GstStructure *request_headers,
+    const GstStructure *headers, gsize size, gint64 lifetime);
+
+#endif /* GSTCURLCACHE_H_ */
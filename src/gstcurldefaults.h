@@ -101,6 +101,8 @@
 #define GSTCURL_HANDLE_MAX_CURLOPT_TIMEOUT 3600
 #define GSTCURL_HANDLE_MIN_CURLOPT_SSL_VERIFYPEER 0
 #define GSTCURL_HANDLE_MAX_CURLOPT_SSL_VERIFYPEER 1
+#define GSTCURL_HANDLE_MIN_CURLOPT_MAXAGE_CONN 1L
+#define GSTCURL_HANDLE_MAX_CURLOPT_MAXAGE_CONN 3600L
 #define GSTCURL_HANDLE_MIN_CURLOPT_HTTP_VERSION CURL_HTTP_VERSION_1_0
 #ifdef CURL_VERSION_HTTP2
 #define GSTCURL_HANDLE_MAX_CURLOPT_HTTP_VERSION CURL_HTTP_VERSION_2_0
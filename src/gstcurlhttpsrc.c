@@ -63,6 +63,117 @@
  * If the "http_proxy" environment variable is set, its value is used.
  * The #GstCurlHttpSrc:proxy property can be used to override the default.
  *
+ * The response body is delivered in buffers of at most #GstBaseSrc:blocksize
+ * bytes, taken from a buffer pool negotiated with downstream. The
+ * #GstCurlHttpSrc:pool-depth property limits how many of these are pooled.
+ *
+ * Seeking in bytes is done with HTTP range requests, so it only works if the
+ * server honours them. A server that answers with Accept-Ranges: none, or
+ * with a 200 response to a range request, makes the stream unseekable.
+ *
+ * While seekable, downstream can also pull from the element. Each read is
+ * served from a small cache of 256KiB blocks, and blocks missing from it are
+ * fetched with a single range request, so small reads close together don't
+ * each cost a round trip to the server.
+ *
+ * Setting #GstCurlHttpSrc:parallel-ranges above 1 spreads a large download
+ * over that many connections. The first request only asks for 4MiB. If the
+ * response gives the size of the resource, the rest is fetched in 4MiB
+ * ranges, that many at a time, and pushed downstream in order.
+ *
+ * For segmented streams, #GstCurlHttpSrc:prefetch-uris takes the URIs that
+ * are coming up next. They are downloaded in the background, each up to
+ * #GstCurlHttpSrc:max-buffer-bytes, while the current one is read. When the
+ * element's URI is then set to one of them, what has been prefetched is
+ * pushed straight away, and anything beyond it is fetched with a range
+ * request.
+ *
+ * With #GstCurlHttpSrc:response-cache set, complete responses that say how
+ * long they stay fresh, through Cache-Control or Expires, are kept in memory
+ * and shared by every instance in the process that has it set too, so that
+ * fetching the same init segment or manifest again needs no network traffic
+ * at all. The GST_CURL_RESPONSE_CACHE_SIZE environment variable sets how many
+ * bytes of responses to keep, 32MiB by default, and the least recently used
+ * go first. Private responses aren't kept, and nor are responses to requests
+ * with credentials or cookies unless they're marked public, or with s-maxage.
+ *
+ * #GstCurlHttpSrc:cache-directory keeps complete responses on disk, where
+ * they outlast the process, up to #GstCurlHttpSrc:cache-directory-size bytes
+ * of them. Fresh ones are served by mapping the file straight into the
+ * buffers that go downstream. A stale one that has an ETag or Last-Modified
+ * header is checked with the server first, using If-None-Match or
+ * If-Modified-Since, and is only downloaded again if it has changed.
+ *
+ * Setting #GstCurlHttpSrc:revalidate does the same for the last few responses
+ * the element itself has had that came with a validator, even those marked
+ * no-cache. Fetching a live manifest again then costs a 304 if it hasn't
+ * changed. The same body is pushed again, and the http-headers
+ * structure says "not-modified" so that downstream can skip parsing it.
+ *
+ * When a transfer is over, how long its DNS lookup, connection, TLS handshake
+ * and first byte took, along with the total time, the bytes received, the
+ * average speed and whether an open connection was reused, are posted as a
+ * "transfer-timing" element message. The same structure is added to the
+ * http-headers event as its "transfer-timing" field, and the event is sent
+ * downstream again.
+ *
+ * Instances on the same worker share its connections, so the
+ * #GstCurlHttpSrc:max-connections-per-server (or -per-proxy, when going
+ * through one) and #GstCurlHttpSrc:max-connections limits are pooled too: the
+ * worker allows the largest asked for by anyone who has queued a transfer on
+ * it since it started.
+ *
+ * Where curl supports it, transfers to the same origin on a worker run as
+ * streams over a single HTTP/2 connection. #GstCurlHttpSrc:priority weights an
+ * element's streams against the rest, so a manifest or audio fetch set to
+ * "high" isn't starved by bulk video on the same connection. Prefetches always
+ * go at "low", as nothing is waiting on them yet.
+ *
+ * With an http-version of 3.0, where curl was built with QUIC support, HTTP/3
+ * is tried first. If no response comes back over it, the element carries on
+ * over HTTP/2. Servers advertising HTTP/3 through Alt-Svc are remembered in a
+ * file shared by the whole process, and from one run to the next, so later
+ * connections go straight to HTTP/3. The version actually used goes in the
+ * "http-version" field of the http-headers event.
+ *
+ * How fast responses are taken in can be shaped, with token buckets, per
+ * element with #GstCurlHttpSrc:max-rate, and across each worker per host with
+ * #GstCurlHttpSrc:max-host-rate and in total with
+ * #GstCurlHttpSrc:max-total-rate (the strictest asked for on a worker wins).
+ * Those two are budgets per worker, not per process: with
+ * GST_CURL_WORKER_THREADS set to more than one, the process as a whole can
+ * take in up to that many times the rate asked for.
+ * A transfer that has used up its budget is paused until the worker has
+ * topped the buckets up again. Transfers with a "high" priority are never
+ * held back by the shared budgets, but what they use comes out of them, so
+ * live transfers keep their bandwidth and everything else makes room.
+ *
+ * Transfers wait on their worker until curl is given them, the most urgent
+ * #GstCurlHttpSrc:priority first. Setting #GstCurlHttpSrc:max-active-transfers
+ * caps how many transfers of an element's priority may be running there at
+ * once before its own wait their turn, so a flood of prefetches or bulk
+ * fetches can't crowd out a manifest fetch at the live edge.
+ *
+ * The rate responses arrive at is measured as curl hands over the body,
+ * counting parallel ranges and prefetches along with it, and leaving out any
+ * time spent paused or between transfers, so it isn't thrown by how unevenly
+ * buffers are taken downstream. The moving average is in
+ * #GstCurlHttpSrc:bandwidth-estimate, in bits per second. At most once a
+ * second, a "bandwidth-estimate" element message carries it, along with the
+ * host and the moving average of transfers to that host on the same worker.
+ *
+ * Instances that ask for the same whole resource, with the same request
+ * headers, while one of them is still waiting for the response share a single
+ * transfer between them. Each one gets the same data as it arrives. One that
+ * falls more than #GstCurlHttpSrc:max-buffer-bytes behind makes its own
+ * request for the rest.
+ *
+ * All instances share the curl worker threads. By default there is one; the
+ * GST_CURL_WORKER_THREADS environment variable sets how many to run, and
+ * GST_CURL_WORKER_POLICY chooses how transfers are spread between them:
+ * "host-affinity" (the default) keeps each host on one worker so that its
+ * connections are reused, "least-loaded" uses the least busy worker.
+ *
  * <refsect2>
  * <title>Example launch line</title>
  * |[
@@ -83,6 +194,23 @@
 
 #include "gstcurlhttpsrc.h"
 #include "gstcurlqueue.h"
+#include "gstcurlcache.h"
+
+/*
+ * Where available, drive curl through its socket interface with epoll rather
+ * than rebuilding fd_sets for select() on every iteration of the multi loop.
+ */
+#if defined(HAVE_SYS_EPOLL_H) && defined(HAVE_SYS_TIMERFD_H) && \
+    defined(HAVE_SYS_EVENTFD_H)
+#define GSTCURL_HAVE_EPOLL 1
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#elif LIBCURL_VERSION_NUM >= 0x074400
+/* curl_multi_poll() and curl_multi_wakeup() arrived in curl 7.68.0 */
+#define GSTCURL_HAVE_MULTI_POLL 1
+#endif
 
 GST_DEBUG_CATEGORY_STATIC (gst_curl_http_src_debug);
 #define GST_CAT_DEFAULT gst_curl_http_src_debug
@@ -108,17 +236,38 @@ static void gst_curl_http_src_get_property (GObject * object, guint prop_id,
 static void gst_curl_http_src_init (GstCurlHttpSrc * source);
 static void gst_curl_http_src_ref_multi (GstCurlHttpSrc * src);
 static void gst_curl_http_src_unref_multi (GstCurlHttpSrc * src);
+static GstCurlHttpSrcMultiTaskContext *gst_curl_http_src_pick_context
+    (GstCurlHttpSrc * src);
 static void gst_curl_http_src_finalize (GObject * obj);
 static GstFlowReturn gst_curl_http_src_create (GstPushSrc * psrc,
     GstBuffer ** outbuf);
+static GstFlowReturn gst_curl_http_src_create_range (GstBaseSrc * bsrc,
+    guint64 offset, guint length, GstBuffer ** outbuf);
+static GstFlowReturn gst_curl_http_src_fetch_range (GstCurlHttpSrc * src,
+    guint64 start, guint64 stop, GstBuffer ** outbuf);
+static GstBuffer *gst_curl_http_src_range_cache_lookup (GstCurlHttpSrc * src,
+    guint64 start);
+static void gst_curl_http_src_range_cache_insert (GstCurlHttpSrc * src,
+    GstBuffer * block);
+static void gst_curl_http_src_range_cache_clear (GstCurlHttpSrc * src);
+static void gst_curl_http_src_abort_transfer (GstCurlHttpSrc * src);
 static GstFlowReturn gst_curl_http_src_handle_response (GstCurlHttpSrc * src);
 static gboolean gst_curl_http_src_negotiate_caps (GstCurlHttpSrc * src);
 static GstStateChangeReturn gst_curl_http_src_change_state (GstElement *
     element, GstStateChange transition);
 static void gst_curl_http_src_cleanup_instance (GstCurlHttpSrc * src);
+static void gst_curl_http_src_forget_resource (GstCurlHttpSrc * src);
+static void gst_curl_http_src_flush_buffer_queue (GstCurlHttpSrc * src);
+static gboolean gst_curl_http_src_open_block (GstCurlHttpSrc * src);
+static void gst_curl_http_src_close_block (GstCurlHttpSrc * src);
 static gboolean gst_curl_http_src_query (GstBaseSrc * bsrc, GstQuery * query);
+static gboolean gst_curl_http_src_is_seekable (GstBaseSrc * bsrc);
+static gboolean gst_curl_http_src_do_seek (GstBaseSrc * bsrc,
+    GstSegment * segment);
 static gboolean gst_curl_http_src_get_content_length (GstBaseSrc * bsrc,
     guint64 * size);
+static gboolean gst_curl_http_src_decide_allocation (GstBaseSrc * bsrc,
+    GstQuery * query);
 static gboolean gst_curl_http_src_unlock (GstBaseSrc * bsrc);
 static gboolean gst_curl_http_src_unlock_stop (GstBaseSrc * bsrc);
 
@@ -134,13 +283,102 @@ static gboolean gst_curl_http_src_urihandler_set_uri (GstURIHandler * handler,
 
 /* GstTask functions */
 static void gst_curl_http_src_curl_multi_loop (gpointer thread_data);
+static void gst_curl_http_src_abort_part (GstCurlHttpSrcMultiTaskContext *
+    context, GstCurlHttpSrcPart * part);
+static void gst_curl_http_src_share_lock (CURL * handle, curl_lock_data data,
+    curl_lock_access access, void *userptr);
+static void gst_curl_http_src_share_unlock (CURL * handle, curl_lock_data data,
+    void *userptr);
+static void gst_curl_http_src_multi_wakeup (GstCurlHttpSrcMultiTaskContext *
+    context);
+#ifdef GSTCURL_HAVE_EPOLL
+static int gst_curl_http_src_multi_socket_cb (CURL * easy, curl_socket_t s,
+    int what, void *userp, void *socketp);
+static int gst_curl_http_src_multi_timer_cb (CURLM * multi, long timeout_ms,
+    void *userp);
+static void gst_curl_http_src_multi_socket_wait (GstCurlHttpSrcMultiTaskContext
+    * context, int timeout_ms);
+#endif
 static CURL *gst_curl_http_src_create_easy_handle (GstCurlHttpSrc * s);
+static void gst_curl_http_src_set_stream_weight (GstCurlHttpSrc * s,
+    CURL * handle, GstCurlHttpSrcPriority priority);
+static CURL *gst_curl_http_src_new_easy_handle (GstCurlHttpSrc * s,
+    guint64 start, guint64 stop, struct curl_slist **slist);
+static gboolean gst_curl_http_src_plan_parts (GstCurlHttpSrc * src);
+static void gst_curl_http_src_submit_parts (GstCurlHttpSrc * src);
+static void gst_curl_http_src_free_parts (GstCurlHttpSrc * src);
+static GstFlowReturn gst_curl_http_src_next_part_buffer (GstCurlHttpSrc * src,
+    GstBuffer ** outbuf);
+static CURL *gst_curl_http_src_new_part_handle (GstCurlHttpSrc * src,
+    GstCurlHttpSrcPart * part);
+static gboolean gst_curl_http_src_parts_running (GQueue * parts);
+static void gst_curl_http_src_free_part (GstCurlHttpSrc * src,
+    GstCurlHttpSrcPart * part);
+static void gst_curl_http_src_set_prefetch_uris (GstCurlHttpSrc * src,
+    gchar ** uris);
+static GstFlowReturn gst_curl_http_src_adopt_prefetch (GstCurlHttpSrc * src);
+static void gst_curl_http_src_reap_prefetches (GstCurlHttpSrc * src);
+static void gst_curl_http_src_cancel_prefetches (GstCurlHttpSrc * src);
+static CURL *gst_curl_http_src_new_prefetch_handle (GstCurlHttpSrc * src,
+    GstCurlHttpSrcPart * prefetch);
+static void gst_curl_http_src_take_response (GstCurlHttpSrc * src,
+    guint status_code, const GstStructure * headers);
+static void gst_curl_http_src_learn_headers (GstCurlHttpSrc * src,
+    const GstStructure * headers);
+static gboolean gst_curl_http_src_serve_cached (GstCurlHttpSrc * src);
+static gboolean gst_curl_http_src_authenticated (GstCurlHttpSrc * src);
+static gboolean gst_curl_http_src_serve_shared (GstCurlHttpSrc * src,
+    GstStructure ** headers, GstBuffer ** body);
+static GstCurlHttpSrcDiskCommit *gst_curl_http_src_store_cached (GstCurlHttpSrc
+    * src);
+static void gst_curl_http_src_commit_cached (GstCurlHttpSrc * src,
+    GstCurlHttpSrcDiskCommit * commit);
+static void gst_curl_http_src_drop_cache_body (GstCurlHttpSrc * src);
+static gboolean gst_curl_http_src_keep_cached (GstCurlHttpSrc * src,
+    GstBuffer * buf);
+static void gst_curl_http_src_write_cached (GstCurlHttpSrc * src,
+    GstBuffer * buf);
+static void gst_curl_http_src_serve_body (GstCurlHttpSrc * src,
+    const GstStructure * headers, GstBuffer * body);
+static void gst_curl_http_src_serve_revalidated (GstCurlHttpSrc * src);
+static void gst_curl_http_src_drop_stale (GstCurlHttpSrc * src);
+static void gst_curl_http_src_collect_timing (CURL * handle);
+static void gst_curl_http_src_publish_timing (GstCurlHttpSrc * src);
+static gboolean gst_curl_http_src_retryable (CURLcode result);
+#ifdef CURL_VERSION_HTTP3
+static gboolean gst_curl_http_src_http3_fallback (GstCurlHttpSrc * src);
+#endif
 static inline void gst_curl_http_src_destroy_easy_handle (GstCurlHttpSrc * src);
+static CURL *gst_curl_http_src_get_pooled_handle (GstCurlHttpSrc * src);
+static void gst_curl_http_src_put_pooled_handle (GstCurlHttpSrc * src,
+    CURL * handle);
 static size_t gst_curl_http_src_get_header (void *header, size_t size,
     size_t nmemb, void *src);
 static size_t gst_curl_http_src_get_chunks (void *chunk, size_t size,
     size_t nmemb, void *src);
+static size_t gst_curl_http_src_get_prefetch_header (void *header,
+    size_t size, size_t nmemb, void *p);
+static size_t gst_curl_http_src_get_prefetch_chunks (void *chunk,
+    size_t size, size_t nmemb, void *p);
+static size_t gst_curl_http_src_get_part_chunks (void *chunk, size_t size,
+    size_t nmemb, void *part);
+static void gst_curl_http_src_forward_header (GstCurlHttpSrc * s,
+    void *header, size_t size, size_t nmemb);
+static void gst_curl_http_src_forward_chunk (GstCurlHttpSrc * s,
+    void *chunk, size_t chunk_len);
+static gdouble gst_curl_http_src_sample_bandwidth (GstCurlHttpSrc * s,
+    size_t chunk_len);
+static void gst_curl_http_src_update_bandwidth (GstCurlHttpSrc * s,
+    const gchar * uri, gdouble rate);
+static void gst_curl_http_src_bucket_set_rate (GstCurlHttpSrcBucket * bucket,
+    guint64 rate);
+static gboolean gst_curl_http_src_shape (GstCurlHttpSrc * s,
+    GstCurlHttpSrcPriority priority, const gchar * uri,
+    GstCurlHttpSrcBucket ** host_bucket, size_t chunk_len);
+static void gst_curl_http_src_throttle (GstCurlHttpSrc * s,
+    GstCurlHttpSrcPart * part);
 static void gst_curl_http_src_request_remove (GstCurlHttpSrc * src);
+static void gst_curl_http_src_request_unpause (GstCurlHttpSrc * src);
 static char *gst_curl_http_src_strcasestr (const char *haystack,
     const char *needle);
 
@@ -149,6 +387,28 @@ G_DEFINE_TYPE_WITH_CODE (GstCurlHttpSrc, gst_curl_http_src, GST_TYPE_PUSH_SRC,
     G_IMPLEMENT_INTERFACE (GST_TYPE_URI_HANDLER,
         gst_curl_http_src_uri_handler_init));
 
+GType
+gst_curl_http_src_priority_get_type (void)
+{
+  static gsize priority_type = 0;
+  static const GEnumValue priorities[] = {
+    {GST_CURL_HTTP_SRC_PRIORITY_HIGH, "Latency critical, e.g. manifests",
+        "high"},
+    {GST_CURL_HTTP_SRC_PRIORITY_NORMAL, "Normal", "normal"},
+    {GST_CURL_HTTP_SRC_PRIORITY_LOW, "Bulk or background, e.g. prefetches",
+        "low"},
+    {0, NULL, NULL}
+  };
+
+  if (g_once_init_enter (&priority_type)) {
+    GType type = g_enum_register_static ("GstCurlHttpSrcPriority",
+        priorities);
+    g_once_init_leave (&priority_type, type);
+  }
+
+  return priority_type;
+}
+
 static void
 gst_curl_http_src_class_init (GstCurlHttpSrcClass * klass)
 {
@@ -157,6 +417,8 @@ gst_curl_http_src_class_init (GstCurlHttpSrcClass * klass)
   GstBaseSrcClass *gstbasesrc_class;
   GstPushSrcClass *gstpushsrc_class;
   const gchar *http_env;
+  const gchar *workers_env;
+  guint i;
 
   gobject_class = (GObjectClass *) klass;
   gstelement_class = (GstElementClass *) klass;
@@ -168,9 +430,16 @@ gst_curl_http_src_class_init (GstCurlHttpSrcClass * klass)
   gstelement_class->change_state =
       GST_DEBUG_FUNCPTR (gst_curl_http_src_change_state);
   gstpushsrc_class->create = GST_DEBUG_FUNCPTR (gst_curl_http_src_create);
+  gstbasesrc_class->create =
+      GST_DEBUG_FUNCPTR (gst_curl_http_src_create_range);
   gstbasesrc_class->query = GST_DEBUG_FUNCPTR (gst_curl_http_src_query);
   gstbasesrc_class->get_size =
       GST_DEBUG_FUNCPTR (gst_curl_http_src_get_content_length);
+  gstbasesrc_class->is_seekable =
+      GST_DEBUG_FUNCPTR (gst_curl_http_src_is_seekable);
+  gstbasesrc_class->do_seek = GST_DEBUG_FUNCPTR (gst_curl_http_src_do_seek);
+  gstbasesrc_class->decide_allocation =
+      GST_DEBUG_FUNCPTR (gst_curl_http_src_decide_allocation);
   gstbasesrc_class->unlock = GST_DEBUG_FUNCPTR (gst_curl_http_src_unlock);
   gstbasesrc_class->unlock_stop =
       GST_DEBUG_FUNCPTR (gst_curl_http_src_unlock_stop);
@@ -326,10 +595,127 @@ gst_curl_http_src_class_init (GstCurlHttpSrcClass * klass)
           GSTCURL_MIN_CONNECTIONS_GLOBAL, GSTCURL_MAX_CONNECTIONS_GLOBAL,
           GSTCURL_DEFAULT_CONNECTIONS_GLOBAL,
           G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_POOL_DEPTH,
+      g_param_spec_uint ("pool-depth", "Pool-Depth",
+          "Maximum number of blocksize receive buffers kept in the buffer "
+          "pool (0 = unlimited)",
+          GSTCURL_MIN_POOL_DEPTH, GSTCURL_MAX_POOL_DEPTH,
+          GSTCURL_DEFAULT_POOL_DEPTH,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_MAX_BUFFER_BYTES,
+      g_param_spec_uint ("max-buffer-bytes", "Max-Buffer-Bytes",
+          "Maximum number of received bytes to hold before pausing the "
+          "transfer until downstream catches up (0 = unlimited)",
+          GSTCURL_MIN_BUFFER_BYTES, GSTCURL_MAX_BUFFER_BYTES,
+          GSTCURL_DEFAULT_BUFFER_BYTES,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_PARALLEL_RANGES,
+      g_param_spec_uint ("parallel-ranges", "Parallel-Ranges",
+          "Number of connections to fetch a large resource over at once, "
+          "in 4MiB ranges (1 = a single transfer)",
+          GSTCURL_MIN_PARALLEL_RANGES, GSTCURL_MAX_PARALLEL_RANGES,
+          GSTCURL_DEFAULT_PARALLEL_RANGES,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_PREFETCH_URIS,
+      g_param_spec_boxed ("prefetch-uris", "Prefetch-URIs",
+          "URIs to start downloading ahead of being set as the location, "
+          "e.g. the next segments of a stream (only the first 4 are used)",
+          G_TYPE_STRV, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_RESPONSE_CACHE,
+      g_param_spec_boolean ("response-cache", "Response-Cache",
+          "Serve fresh responses from, and keep cacheable ones in, the "
+          "in-memory cache shared by every instance", FALSE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_CACHE_DIRECTORY,
+      g_param_spec_string ("cache-directory", "Cache-Directory",
+          "Directory to keep complete responses in, to be served from disk "
+          "later on (NULL = none)", NULL,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_CACHE_DIRECTORY_SIZE,
+      g_param_spec_uint64 ("cache-directory-size", "Cache-Directory-Size",
+          "Most bytes of response bodies to keep in the cache directory", 0,
+          G_MAXUINT64, GSTCURL_DEFAULT_CACHE_DIRECTORY_SIZE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_REVALIDATE,
+      g_param_spec_boolean ("revalidate", "Revalidate",
+          "Remember recent responses with an ETag or Last-Modified header, and "
+          "ask the server whether they've changed when fetching them again",
+          FALSE, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_BANDWIDTH_ESTIMATE,
+      g_param_spec_uint64 ("bandwidth-estimate", "Bandwidth-Estimate",
+          "Moving average of the rate responses arrive at, in bits per second "
+          "(0 = not known yet)", 0, G_MAXUINT64, 0,
+          G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_PRIORITY,
+      g_param_spec_enum ("priority", "Priority",
+          "How urgent our transfers are. Higher priority transfers are let on "
+          "to curl first, and over HTTP/2 this sets the weight of their "
+          "streams against others on the same connection",
+          GST_TYPE_CURL_HTTP_SRC_PRIORITY, GST_CURL_HTTP_SRC_PRIORITY_NORMAL,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_MAX_ACTIVE_TRANSFERS,
+      g_param_spec_uint ("max-active-transfers", "Max-Active-Transfers",
+          "Maximum number of transfers of our priority running on our worker "
+          "at once before ours wait their turn (0 = unlimited)",
+          GSTCURL_MIN_ACTIVE_TRANSFERS, GSTCURL_MAX_ACTIVE_TRANSFERS,
+          GSTCURL_DEFAULT_ACTIVE_TRANSFERS,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_MAX_RATE,
+      g_param_spec_uint64 ("max-rate", "Max-Rate",
+          "Maximum rate to take our responses in at, in bits per second "
+          "(0 = unlimited)", 0, G_MAXUINT64, 0,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_MAX_HOST_RATE,
+      g_param_spec_uint64 ("max-host-rate", "Max-Host-Rate",
+          "Maximum rate to take responses in from any one host at, across "
+          "our worker, in bits per second (0 = unlimited). Each worker has "
+          "its own budget", 0, G_MAXUINT64, 0,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_MAX_TOTAL_RATE,
+      g_param_spec_uint64 ("max-total-rate", "Max-Total-Rate",
+          "Maximum rate to take all responses in at, across our worker, in "
+          "bits per second (0 = unlimited). Each worker has its own budget, "
+          "so with several the process can take in up to this many times "
+          "the number of workers", 0, G_MAXUINT64, 0,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_HANDLE_POOL_STATS,
+      g_param_spec_boxed ("handle-pool-stats", "Handle-Pool-Stats",
+          "Hits, misses and idle handles in the process-wide pool of curl "
+          "easy handles", GST_TYPE_STRUCTURE,
+          G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+#ifdef CURL_VERSION_HTTP3
+  if (gst_curl_http_src_curl_capabilities->features & CURL_VERSION_HTTP3) {
+    GST_INFO_OBJECT (klass, "Our curl version (%s) supports HTTP3!",
+        gst_curl_http_src_curl_capabilities->version);
+    g_object_class_install_property (gobject_class, PROP_HTTPVERSION,
+        g_param_spec_float ("http-version", "HTTP-Version",
+            "The preferred HTTP protocol version (Supported 1.0, 1.1, 2.0, "
+            "3.0)", 1.0, 3.0, pref_http_ver,
+            G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  } else
+#endif
 #ifdef CURL_VERSION_HTTP2
   if (gst_curl_http_src_curl_capabilities->features && CURL_VERSION_HTTP2) {
     GST_INFO_OBJECT (klass, "Our curl version (%s) supports HTTP2!",
         gst_curl_http_src_curl_capabilities->version);
+    if (pref_http_ver > 2.0) {
+      pref_http_ver = GSTCURL_HANDLE_DEFAULT_CURLOPT_HTTP_VERSION;
+    }
     g_object_class_install_property (gobject_class, PROP_HTTPVERSION,
         g_param_spec_float ("http-version", "HTTP-Version",
             "The preferred HTTP protocol version (Supported 1.0, 1.1, 2.0)",
@@ -349,15 +735,92 @@ gst_curl_http_src_class_init (GstCurlHttpSrcClass * klass)
   }
 #endif
 
+  klass->altsvc_file = NULL;
+#ifdef CURL_VERSION_HTTP3
+  if ((gst_curl_http_src_curl_capabilities->features & CURL_VERSION_HTTP3) &&
+      (gst_curl_http_src_curl_capabilities->features & CURL_VERSION_ALTSVC)) {
+    const gchar *altsvc_env = g_getenv ("GST_CURL_ALTSVC_FILE");
+
+    if (altsvc_env != NULL) {
+      klass->altsvc_file = g_strdup (altsvc_env);
+    } else {
+      /* The directory is only made once something actually uses HTTP/3 */
+      klass->altsvc_file = g_build_filename (g_get_user_cache_dir (),
+          "gstcurlhttpsrc", "altsvc.txt", NULL);
+    }
+    GST_INFO_OBJECT (klass, "Keeping the Alt-Svc cache in %s",
+        klass->altsvc_file);
+  }
+#endif
+
   /* Add a debugging task so it's easier to debug in the Multi worker thread */
   GST_DEBUG_CATEGORY_INIT (gst_curl_loop_debug, "curl_multi_loop", 0,
       "libcURL loop thread debugging");
   gst_debug_log (gst_curl_loop_debug, GST_LEVEL_INFO, __FILE__, __func__,
       __LINE__, NULL, "Testing the curl_multi_loop debugging prints");
 
-  g_mutex_init (&klass->multi_task_context.mutex);
-  g_cond_init (&klass->multi_task_context.signal);
-  g_rec_mutex_init (&klass->multi_task_context.task_rec_mutex);
+  klass->n_workers = GSTCURL_DEFAULT_WORKER_THREADS;
+  workers_env = g_getenv ("GST_CURL_WORKER_THREADS");
+  if (workers_env != NULL) {
+    klass->n_workers = (guint) g_ascii_strtoull (workers_env, NULL, 10);
+    klass->n_workers = CLAMP (klass->n_workers, GSTCURL_MIN_WORKER_THREADS,
+        GSTCURL_MAX_WORKER_THREADS);
+    GST_INFO_OBJECT (klass, "Seen env var GST_CURL_WORKER_THREADS, using %u "
+        "curl worker threads", klass->n_workers);
+  }
+  klass->worker_policy = GSTCURL_WORKER_POLICY_HOST_AFFINITY;
+  workers_env = g_getenv ("GST_CURL_WORKER_POLICY");
+  if (g_strcmp0 (workers_env, "least-loaded") == 0) {
+    klass->worker_policy = GSTCURL_WORKER_POLICY_LEAST_LOADED;
+  }
+
+  for (i = 0; i < klass->n_workers; i++) {
+    klass->multi_task_context[i].id = i;
+    g_mutex_init (&klass->multi_task_context[i].mutex);
+    g_cond_init (&klass->multi_task_context[i].signal);
+    g_rec_mutex_init (&klass->multi_task_context[i].task_rec_mutex);
+  }
+
+  /*
+   * Process-wide share object. Cookies are deliberately left out, as each
+   * instance has its own cookies property and they shouldn't leak between
+   * unrelated pipelines.
+   */
+  for (i = 0; i < CURL_LOCK_DATA_LAST; i++) {
+    g_mutex_init (&klass->share_mutex[i]);
+  }
+  g_mutex_init (&klass->handle_pool_mutex);
+  g_queue_init (&klass->handle_pool);
+  klass->handle_pool_hits = 0;
+  klass->handle_pool_misses = 0;
+  gst_curl_http_src_cache_init (klass);
+
+  klass->share_handle = curl_share_init ();
+  if (klass->share_handle != NULL) {
+    curl_share_setopt (klass->share_handle, CURLSHOPT_LOCKFUNC,
+        gst_curl_http_src_share_lock);
+    curl_share_setopt (klass->share_handle, CURLSHOPT_UNLOCKFUNC,
+        gst_curl_http_src_share_unlock);
+    curl_share_setopt (klass->share_handle, CURLSHOPT_USERDATA, klass);
+    curl_share_setopt (klass->share_handle, CURLSHOPT_SHARE,
+        CURL_LOCK_DATA_DNS);
+    curl_share_setopt (klass->share_handle, CURLSHOPT_SHARE,
+        CURL_LOCK_DATA_SSL_SESSION);
+#if LIBCURL_VERSION_NUM >= 0x073900
+    /*
+     * Connection cache sharing arrived in curl 7.57.0. curl can't have one
+     * used from multi handles on different threads, though, so with more
+     * than one worker each keeps its own connections.
+     */
+    if (klass->n_workers == 1) {
+      curl_share_setopt (klass->share_handle, CURLSHOPT_SHARE,
+          CURL_LOCK_DATA_CONNECT);
+    }
+#endif
+  } else {
+    GST_WARNING_OBJECT (klass, "Couldn't create curl share handle, DNS and "
+        "TLS session caches won't be shared");
+  }
 
   gst_element_class_set_static_metadata (gstelement_class,
       "HTTP Client Source using libcURL",
@@ -380,6 +843,7 @@ gst_curl_http_src_set_property (GObject * object, guint prop_id,
         g_free (source->uri);
       }
       source->uri = g_value_dup_string (value);
+      gst_curl_http_src_forget_resource (source);
       break;
     case PROP_USERNAME:
       if (source->username != NULL) {
@@ -475,10 +939,55 @@ gst_curl_http_src_set_property (GObject * object, guint prop_id,
 #ifdef CURL_VERSION_HTTP2
       } else if (f == 2.0) {
         source->preferred_http_version = GSTCURL_HTTP_VERSION_2_0;
+#endif
+#ifdef CURL_VERSION_HTTP3
+      } else if (f == 3.0) {
+        source->preferred_http_version = GSTCURL_HTTP_VERSION_3_0;
 #endif
       } else {
         source->preferred_http_version = GSTCURL_HTTP_VERSION_1_1;
       }
+      source->http3_failed = FALSE;
+      break;
+    case PROP_POOL_DEPTH:
+      source->pool_depth = g_value_get_uint (value);
+      break;
+    case PROP_MAX_BUFFER_BYTES:
+      source->max_buffer_bytes = g_value_get_uint (value);
+      break;
+    case PROP_PARALLEL_RANGES:
+      source->parallel_ranges = g_value_get_uint (value);
+      break;
+    case PROP_PREFETCH_URIS:
+      gst_curl_http_src_set_prefetch_uris (source, g_value_get_boxed (value));
+      break;
+    case PROP_RESPONSE_CACHE:
+      source->response_cache = g_value_get_boolean (value);
+      break;
+    case PROP_CACHE_DIRECTORY:
+      g_free (source->cache_directory);
+      source->cache_directory = g_value_dup_string (value);
+      break;
+    case PROP_CACHE_DIRECTORY_SIZE:
+      source->cache_directory_size = g_value_get_uint64 (value);
+      break;
+    case PROP_REVALIDATE:
+      source->revalidate = g_value_get_boolean (value);
+      break;
+    case PROP_PRIORITY:
+      source->priority = g_value_get_enum (value);
+      break;
+    case PROP_MAX_ACTIVE_TRANSFERS:
+      source->max_active_transfers = g_value_get_uint (value);
+      break;
+    case PROP_MAX_RATE:
+      source->max_rate = g_value_get_uint64 (value);
+      break;
+    case PROP_MAX_HOST_RATE:
+      source->max_host_rate = g_value_get_uint64 (value);
+      break;
+    case PROP_MAX_TOTAL_RATE:
+      source->max_total_rate = g_value_get_uint64 (value);
       break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
@@ -570,11 +1079,92 @@ gst_curl_http_src_get_property (GObject * object, guint prop_id,
         case GSTCURL_HTTP_VERSION_2_0:
           g_value_set_float (value, 2.0);
           break;
+#endif
+#ifdef CURL_VERSION_HTTP3
+        case GSTCURL_HTTP_VERSION_3_0:
+          g_value_set_float (value, 3.0);
+          break;
 #endif
         default:
           GST_WARNING_OBJECT (source, "Bad HTTP version in object");
       }
       break;
+    case PROP_POOL_DEPTH:
+      g_value_set_uint (value, source->pool_depth);
+      break;
+    case PROP_MAX_BUFFER_BYTES:
+      g_value_set_uint (value, source->max_buffer_bytes);
+      break;
+    case PROP_PARALLEL_RANGES:
+      g_value_set_uint (value, source->parallel_ranges);
+      break;
+    case PROP_PREFETCH_URIS:
+    {
+      GPtrArray *uris = g_ptr_array_new ();
+      GList *link;
+
+      g_mutex_lock (&source->buffer_mutex);
+      for (link = source->prefetches.head; link != NULL; link = link->next) {
+        GstCurlHttpSrcPart *prefetch = link->data;
+        if (prefetch->cancelled == FALSE) {
+          g_ptr_array_add (uris, g_strdup (prefetch->uri));
+        }
+      }
+      g_mutex_unlock (&source->buffer_mutex);
+      g_ptr_array_add (uris, NULL);
+      g_value_take_boxed (value, g_ptr_array_free (uris, FALSE));
+    }
+      break;
+    case PROP_RESPONSE_CACHE:
+      g_value_set_boolean (value, source->response_cache);
+      break;
+    case PROP_CACHE_DIRECTORY:
+      g_value_set_string (value, source->cache_directory);
+      break;
+    case PROP_CACHE_DIRECTORY_SIZE:
+      g_value_set_uint64 (value, source->cache_directory_size);
+      break;
+    case PROP_REVALIDATE:
+      g_value_set_boolean (value, source->revalidate);
+      break;
+    case PROP_BANDWIDTH_ESTIMATE:
+      g_mutex_lock (&source->buffer_mutex);
+      g_value_set_uint64 (value, (guint64) source->bandwidth);
+      g_mutex_unlock (&source->buffer_mutex);
+      break;
+    case PROP_PRIORITY:
+      g_value_set_enum (value, source->priority);
+      break;
+    case PROP_MAX_ACTIVE_TRANSFERS:
+      g_value_set_uint (value, source->max_active_transfers);
+      break;
+    case PROP_MAX_RATE:
+      g_value_set_uint64 (value, source->max_rate);
+      break;
+    case PROP_MAX_HOST_RATE:
+      g_value_set_uint64 (value, source->max_host_rate);
+      break;
+    case PROP_MAX_TOTAL_RATE:
+      g_value_set_uint64 (value, source->max_total_rate);
+      break;
+    case PROP_HANDLE_POOL_STATS:
+    {
+      GstCurlHttpSrcClass *klass = G_TYPE_INSTANCE_GET_CLASS (source,
+          GST_TYPE_CURL_HTTP_SRC,
+          GstCurlHttpSrcClass);
+      GstStructure *stats;
+
+      g_mutex_lock (&klass->handle_pool_mutex);
+      stats = gst_structure_new (HANDLE_POOL_STATS_NAME,
+          HANDLE_POOL_HITS, G_TYPE_UINT64, klass->handle_pool_hits,
+          HANDLE_POOL_MISSES, G_TYPE_UINT64, klass->handle_pool_misses,
+          HANDLE_POOL_IDLE, G_TYPE_UINT, g_queue_get_length (&klass->
+              handle_pool), NULL);
+      g_mutex_unlock (&klass->handle_pool_mutex);
+      gst_value_set_structure (value, stats);
+      gst_structure_free (stats);
+    }
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -610,8 +1200,16 @@ gst_curl_http_src_init (GstCurlHttpSrc * source)
   source->strict_ssl = GSTCURL_HANDLE_DEFAULT_CURLOPT_SSL_VERIFYPEER;
   source->custom_ca_file = NULL;
   source->preferred_http_version = pref_http_ver;
+  source->http3_failed = FALSE;
   source->total_retries = GSTCURL_HANDLE_DEFAULT_RETRIES;
   source->retries_remaining = source->total_retries;
+  source->priority = GST_CURL_HTTP_SRC_PRIORITY_NORMAL;
+  source->max_active_transfers = GSTCURL_DEFAULT_ACTIVE_TRANSFERS;
+  source->max_rate = 0;
+  source->max_host_rate = 0;
+  source->max_total_rate = 0;
+  memset (&source->bucket, 0, sizeof (source->bucket));
+  source->host_bucket = NULL;
   source->slist = NULL;
 
   gst_caps_replace (&source->caps, NULL);
@@ -624,14 +1222,62 @@ gst_curl_http_src_init (GstCurlHttpSrc * source)
   g_mutex_init (&source->buffer_mutex);
   g_cond_init (&source->signal);
 
-  source->buffer = NULL;
+  g_queue_init (&source->buffer_queue);
   source->buffer_len = 0;
+  source->pool = NULL;
+  source->pool_depth = GSTCURL_DEFAULT_POOL_DEPTH;
+  source->block_size = GSTCURL_DEFAULT_BLOCK_SIZE;
+  source->block = NULL;
+  source->block_fill = 0;
+  source->max_buffer_bytes = GSTCURL_DEFAULT_BUFFER_BYTES;
+  source->paused = FALSE;
+  source->curl_handle = NULL;
+  source->context = NULL;
+  source->queue_element = NULL;
+  gst_base_src_set_blocksize (GST_BASE_SRC (source),
+      GSTCURL_DEFAULT_BLOCK_SIZE);
   source->state = GSTCURL_NONE;
   source->pending_state = GSTCURL_NONE;
   source->status_code = 0;
 
   source->http_headers = NULL;
   source->hdrs_updated = FALSE;
+  source->timing = NULL;
+
+  source->request_position = 0;
+  source->stop_position = -1;
+  source->read_position = 0;
+  source->content_size = 0;
+  source->have_size = FALSE;
+  source->seekable = TRUE;
+  source->etag = NULL;
+  source->last_modified = NULL;
+  g_queue_init (&source->range_cache);
+  source->parallel_ranges = GSTCURL_DEFAULT_PARALLEL_RANGES;
+  source->transfer_stop = -1;
+  source->next_part_start = 0;
+  g_queue_init (&source->parts);
+  source->parallel_disabled = FALSE;
+  g_queue_init (&source->prefetches);
+  source->following = NULL;
+  source->followed = FALSE;
+  source->response_cache = FALSE;
+  source->cache_body = NULL;
+  source->cache_headers = NULL;
+  source->cache_lifetime = 0;
+  source->cache_directory = NULL;
+  source->cache_directory_size = GSTCURL_DEFAULT_CACHE_DIRECTORY_SIZE;
+  source->cache_fd = -1;
+  source->cache_file = NULL;
+  source->cache_file_size = 0;
+  source->stale_headers = NULL;
+  source->stale_body = NULL;
+  source->revalidate = FALSE;
+  g_queue_init (&source->validated);
+  source->bandwidth_sample_start = 0;
+  source->bandwidth_sample_bytes = 0;
+  source->bandwidth = 0;
+  source->bandwidth_posted = 0;
 
   source->curl_result = CURLE_OK;
 
@@ -639,44 +1285,83 @@ gst_curl_http_src_init (GstCurlHttpSrc * source)
 }
 
 /*
- * Check if the Curl multi loop has been started. If not, initialise it and
+ * Check if a Curl multi loop has been started. If not, initialise it and
  * start it running. If it is already running, increment the refcount.
  */
 static void
-gst_curl_http_src_ref_multi (GstCurlHttpSrc * src)
+gst_curl_http_src_ref_context (GstCurlHttpSrcMultiTaskContext * context)
 {
-  GstCurlHttpSrcClass *klass;
-
-  GSTCURL_FUNCTION_ENTRY (src);
-
-  /*klass = (GstCurlHttpSrcClass) g_type_class_peek_parent (src); */
-  klass = G_TYPE_INSTANCE_GET_CLASS (src, GST_TYPE_CURL_HTTP_SRC,
-      GstCurlHttpSrcClass);
-
-  g_mutex_lock (&klass->multi_task_context.mutex);
-  if (klass->multi_task_context.refcount == 0) {
+  g_mutex_lock (&context->mutex);
+  if (context->refcount == 0) {
     /* Set up various in-task properties */
-
-    /* NULL is treated as the start of the list, no need to allocate. */
-    klass->multi_task_context.queue = NULL;
+    context->state = GSTCURL_MULTI_LOOP_STATE_WAIT;
+
+    gst_curl_http_src_init_queue (&context->queue);
+    gst_curl_http_src_init_queue (&context->pending_queue);
+    context->removal_requests = NULL;
+    context->unpause_requests = NULL;
+    context->host_bandwidth = g_hash_table_new_full (g_str_hash, g_str_equal,
+        g_free, g_free);
+    context->max_host_connections = 0;
+    context->max_total_connections = 0;
+    context->max_host_rate = 0;
+    context->max_total_rate = 0;
+    context->limits_changed = FALSE;
+    memset (&context->total_bucket, 0, sizeof (context->total_bucket));
+    context->host_rate = 0;
+    context->host_buckets = g_hash_table_new_full (g_str_hash, g_str_equal,
+        g_free, g_free);
 
     /* set up curl */
-    klass->multi_task_context.multi_handle = curl_multi_init ();
+    context->multi_handle = curl_multi_init ();
+    context->running_handles = 0;
 
-    curl_multi_setopt (klass->multi_task_context.multi_handle,
-        CURLMOPT_PIPELINING, 1);
-#ifdef CURLMOPT_MAX_HOST_CONNECTIONS
-    curl_multi_setopt (klass->multi_task_context.multi_handle,
-        CURLMOPT_MAX_HOST_CONNECTIONS, 1);
+#ifdef GSTCURL_HAVE_EPOLL
+    {
+      struct epoll_event ev;
+
+      context->epoll_fd = epoll_create1 (EPOLL_CLOEXEC);
+      context->timer_fd = timerfd_create (CLOCK_MONOTONIC,
+          TFD_NONBLOCK | TFD_CLOEXEC);
+      context->wakeup_fd = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC);
+      if ((context->epoll_fd < 0) || (context->timer_fd < 0) ||
+          (context->wakeup_fd < 0)) {
+        GSTCURL_ERROR_PRINT ("Couldn't create epoll/timer fds! Aborting.");
+        abort ();
+      }
+      memset (&ev, 0, sizeof (ev));
+      ev.events = EPOLLIN;
+      ev.data.fd = context->timer_fd;
+      epoll_ctl (context->epoll_fd, EPOLL_CTL_ADD, context->timer_fd, &ev);
+      ev.data.fd = context->wakeup_fd;
+      epoll_ctl (context->epoll_fd, EPOLL_CTL_ADD, context->wakeup_fd, &ev);
+    }
+
+    curl_multi_setopt (context->multi_handle, CURLMOPT_SOCKETFUNCTION,
+        gst_curl_http_src_multi_socket_cb);
+    curl_multi_setopt (context->multi_handle, CURLMOPT_SOCKETDATA, context);
+    curl_multi_setopt (context->multi_handle, CURLMOPT_TIMERFUNCTION,
+        gst_curl_http_src_multi_timer_cb);
+    curl_multi_setopt (context->multi_handle, CURLMOPT_TIMERDATA, context);
+#endif
+
+#ifdef CURLPIPE_MULTIPLEX
+    /*
+     * Run transfers to the same origin as streams over one HTTP/2 connection.
+     * HTTP/1.1 pipelining was dropped in curl 7.62.0, so don't ask for it.
+     */
+    curl_multi_setopt (context->multi_handle, CURLMOPT_PIPELINING,
+        CURLPIPE_MULTIPLEX);
+#else
+    curl_multi_setopt (context->multi_handle, CURLMOPT_PIPELINING, 1);
 #endif
 
     /* Start the thread */
-    klass->multi_task_context.task = gst_task_new (
+    context->task = gst_task_new (
         (GstTaskFunction) gst_curl_http_src_curl_multi_loop,
-        (gpointer) & klass->multi_task_context, NULL);
-    gst_task_set_lock (klass->multi_task_context.task,
-        &klass->multi_task_context.task_rec_mutex);
-    if (gst_task_start (klass->multi_task_context.task) == FALSE) {
+        (gpointer) context, NULL);
+    gst_task_set_lock (context->task, &context->task_rec_mutex);
+    if (gst_task_start (context->task) == FALSE) {
       /*
        * This is a pretty critical failure and is not recoverable, so commit
        * sudoku and run away.
@@ -684,48 +1369,245 @@ gst_curl_http_src_ref_multi (GstCurlHttpSrc * src)
       GSTCURL_ERROR_PRINT ("Couldn't start curl_multi task! Aborting.");
       abort ();
     }
-    GSTCURL_INFO_PRINT ("Curl multi loop has been correctly initialised!");
+    GSTCURL_INFO_PRINT ("Curl multi loop %u has been correctly initialised!",
+        context->id);
+  }
+  context->refcount++;
+  g_mutex_unlock (&context->mutex);
+}
+
+/*
+ * Decrement the reference count on a curl multi loop. If this is called by
+ * the last instance to hold a reference, shut down the worker. (Otherwise
+ * GStreamer can't close down with a thread still running).
+ */
+static void
+gst_curl_http_src_unref_context (GstCurlHttpSrcMultiTaskContext * context)
+{
+  g_mutex_lock (&context->mutex);
+  context->refcount--;
+  GSTCURL_INFO_PRINT ("Worker thread %u refcount is now %u", context->id,
+      context->refcount);
+
+  if (context->refcount <= 0) {
+    /* Everything's done! Clean up. */
+    gst_task_pause (context->task);
+    context->state = GSTCURL_MULTI_LOOP_STATE_STOP;
+    gst_curl_http_src_multi_wakeup (context);
+    g_mutex_unlock (&context->mutex);
+    gst_task_join (context->task);
+    g_slist_free (context->removal_requests);
+    context->removal_requests = NULL;
+    g_slist_free (context->unpause_requests);
+    context->unpause_requests = NULL;
+    g_hash_table_destroy (context->host_bandwidth);
+    context->host_bandwidth = NULL;
+    g_hash_table_destroy (context->host_buckets);
+    context->host_buckets = NULL;
+#ifdef GSTCURL_HAVE_EPOLL
+    /* The sockets are registered against the epoll fd, so lose curl first */
+    curl_multi_cleanup (context->multi_handle);
+    context->multi_handle = NULL;
+    close (context->wakeup_fd);
+    close (context->timer_fd);
+    close (context->epoll_fd);
+    context->wakeup_fd = -1;
+    context->timer_fd = -1;
+    context->epoll_fd = -1;
+#endif
+  } else {
+    g_mutex_unlock (&context->mutex);
+  }
+}
+
+/*
+ * Merge an instance's connection limits into those of the context it's about
+ * to queue a transfer on. Whoever asks for the most connections gets them, so
+ * nobody's transfers are held up behind a stricter neighbour's. Going through
+ * a proxy, every connection is to the proxy, so its limit counts instead.
+ * Must be called with the context mutex held.
+ */
+static void
+gst_curl_http_src_merge_limits (GstCurlHttpSrcMultiTaskContext * context,
+    GstCurlHttpSrc * src)
+{
+  guint per_host;
+
+  if ((src->proxy_uri != NULL) && (*src->proxy_uri != '\0')) {
+    per_host = src->max_conns_per_proxy;
+  } else {
+    per_host = src->max_conns_per_server;
+  }
+
+  if (per_host > context->max_host_connections) {
+    context->max_host_connections = per_host;
+    context->limits_changed = TRUE;
+  }
+  if (src->max_conns_global > context->max_total_connections) {
+    context->max_total_connections = src->max_conns_global;
+    context->limits_changed = TRUE;
+  }
+
+  /* A bandwidth budget is only any use if everyone sticks to it, though */
+  if ((src->max_host_rate > 0) && ((context->max_host_rate == 0) ||
+          (src->max_host_rate < context->max_host_rate))) {
+    context->max_host_rate = src->max_host_rate;
+    context->limits_changed = TRUE;
+  }
+  if ((src->max_total_rate > 0) && ((context->max_total_rate == 0) ||
+          (src->max_total_rate < context->max_total_rate))) {
+    context->max_total_rate = src->max_total_rate;
+    context->limits_changed = TRUE;
+  }
+}
+
+/*
+ * Hand the context's connection limits to curl, and its bandwidth budgets to
+ * the shaping buckets. The multi handle is only touched from the worker, so
+ * this must be called from there, with the context mutex held. The connection
+ * cache is sized to match the total, so idle connections are kept for as
+ * many as may be open at once.
+ */
+static void
+gst_curl_http_src_apply_limits (GstCurlHttpSrcMultiTaskContext * context)
+{
+  GHashTableIter iter;
+  gpointer bucket;
+
+  GSTCURL_INFO_PRINT ("Worker %u allowing %u connections per host, %u in all",
+      context->id, context->max_host_connections,
+      context->max_total_connections);
+
+  gst_curl_http_src_bucket_set_rate (&context->total_bucket,
+      context->max_total_rate / 8);
+  context->host_rate = context->max_host_rate / 8;
+  g_hash_table_iter_init (&iter, context->host_buckets);
+  while (g_hash_table_iter_next (&iter, NULL, &bucket) == TRUE) {
+    gst_curl_http_src_bucket_set_rate (bucket, context->host_rate);
+  }
+
+#if LIBCURL_VERSION_NUM >= 0x071e00
+  /* Both arrived in curl 7.30.0 */
+  curl_multi_setopt (context->multi_handle, CURLMOPT_MAX_HOST_CONNECTIONS,
+      (long) context->max_host_connections);
+  curl_multi_setopt (context->multi_handle, CURLMOPT_MAX_TOTAL_CONNECTIONS,
+      (long) context->max_total_connections);
+#endif
+  curl_multi_setopt (context->multi_handle, CURLMOPT_MAXCONNECTS,
+      (long) context->max_total_connections);
+  context->limits_changed = FALSE;
+}
+
+/*
+ * Take a reference on every curl multi worker, starting them if need be. A
+ * transfer can be handed to any of them, see ::_pick_context().
+ */
+static void
+gst_curl_http_src_ref_multi (GstCurlHttpSrc * src)
+{
+  GstCurlHttpSrcClass *klass;
+  guint i;
+
+  GSTCURL_FUNCTION_ENTRY (src);
+
+  klass = G_TYPE_INSTANCE_GET_CLASS (src, GST_TYPE_CURL_HTTP_SRC,
+      GstCurlHttpSrcClass);
+
+  for (i = 0; i < klass->n_workers; i++) {
+    gst_curl_http_src_ref_context (&klass->multi_task_context[i]);
   }
-  klass->multi_task_context.refcount++;
-  g_mutex_unlock (&klass->multi_task_context.mutex);
 
   GSTCURL_FUNCTION_EXIT (src);
 }
 
 /*
- * Decrement the reference count on the curl multi loop. If this is called by
- * the last instance to hold a reference, shut down the worker. (Otherwise
- * GStreamer can't close down with a thread still running). Also offers the
- * "force_all" boolean parameter, which if TRUE removes all references and shuts
- * down.
+ * Drop this instance's reference on every curl multi worker.
  */
 static void
 gst_curl_http_src_unref_multi (GstCurlHttpSrc * src)
 {
   GstCurlHttpSrcClass *klass;
+  guint i;
 
   GSTCURL_FUNCTION_ENTRY (src);
 
   klass = G_TYPE_INSTANCE_GET_CLASS (src, GST_TYPE_CURL_HTTP_SRC,
       GstCurlHttpSrcClass);
 
-  g_mutex_lock (&klass->multi_task_context.mutex);
-  klass->multi_task_context.refcount--;
-  GST_INFO_OBJECT (src, "Closing instance, worker thread refcount is now %u",
-      klass->multi_task_context.refcount);
+  GST_INFO_OBJECT (src, "Closing instance, releasing %u worker thread(s)",
+      klass->n_workers);
+  for (i = 0; i < klass->n_workers; i++) {
+    gst_curl_http_src_unref_context (&klass->multi_task_context[i]);
+  }
+
+  GSTCURL_FUNCTION_EXIT (src);
+}
+
+/*
+ * Pull the host (and port) out of a URI, for keeping a host's transfers on
+ * one worker. Returns a newly allocated string, or NULL.
+ */
+static gchar *
+gst_curl_http_src_uri_host (const gchar * uri)
+{
+  const gchar *start, *end, *at;
+
+  if (uri == NULL) {
+    return NULL;
+  }
+  start = strstr (uri, "://");
+  start = (start == NULL) ? uri : start + 3;
+  end = start + strcspn (start, "/?#");
+  /* Skip over any user:password@ part */
+  at = memchr (start, '@', end - start);
+  if (at != NULL) {
+    start = at + 1;
+  }
+
+  return g_ascii_strdown (start, end - start);
+}
+
+/*
+ * Choose which curl multi worker a new transfer goes to. With host affinity
+ * (the default) every transfer to a given host lands on the same worker, so
+ * its connections get reused; least-loaded picks whichever worker has the
+ * fewest transfers.
+ */
+static GstCurlHttpSrcMultiTaskContext *
+gst_curl_http_src_pick_context (GstCurlHttpSrc * src)
+{
+  GstCurlHttpSrcClass *klass;
+  guint i, best, load, best_load;
+  gchar *host;
+
+  klass = G_TYPE_INSTANCE_GET_CLASS (src, GST_TYPE_CURL_HTTP_SRC,
+      GstCurlHttpSrcClass);
+
+  if (klass->n_workers == 1) {
+    return &klass->multi_task_context[0];
+  }
 
-  if (klass->multi_task_context.refcount <= 0) {
-    /* Everything's done! Clean up. */
-    gst_task_pause (klass->multi_task_context.task);
-    klass->multi_task_context.state = GSTCURL_MULTI_LOOP_STATE_STOP;
-    g_cond_signal (&klass->multi_task_context.signal);
-    g_mutex_unlock (&klass->multi_task_context.mutex);
-    gst_task_join (klass->multi_task_context.task);
+  if (klass->worker_policy == GSTCURL_WORKER_POLICY_HOST_AFFINITY) {
+    host = gst_curl_http_src_uri_host (src->uri);
+    best = (host != NULL) ? g_str_hash (host) % klass->n_workers : 0;
+    g_free (host);
   } else {
-    g_mutex_unlock (&klass->multi_task_context.mutex);
+    best = 0;
+    best_load = G_MAXUINT;
+    for (i = 0; i < klass->n_workers; i++) {
+      g_mutex_lock (&klass->multi_task_context[i].mutex);
+      load = klass->multi_task_context[i].queue.length +
+          klass->multi_task_context[i].pending_queue.length;
+      g_mutex_unlock (&klass->multi_task_context[i].mutex);
+      if (load < best_load) {
+        best = i;
+        best_load = load;
+      }
+    }
   }
 
-  GSTCURL_FUNCTION_EXIT (src);
+  GST_DEBUG_OBJECT (src, "Using curl worker %u for URI %s", best, src->uri);
+  return &klass->multi_task_context[best];
 }
 
 static void
@@ -751,10 +1633,14 @@ gst_curl_http_src_create (GstPushSrc * psrc, GstBuffer ** outbuf)
 {
   GstFlowReturn ret;
   GstCurlHttpSrc *src = GST_CURLHTTPSRC (psrc);
-  GstCurlHttpSrcClass *klass;
-
-  klass = G_TYPE_INSTANCE_GET_CLASS (src, GST_TYPE_CURL_HTTP_SRC,
-      GstCurlHttpSrcClass);
+  GstCurlHttpSrcMultiTaskContext *context;
+  gboolean unpause = FALSE;
+  gboolean submit = FALSE;
+  gboolean coalesce;
+  guint64 resume_position;
+  GstCurlHttpSrcDiskCommit *disk_commit = NULL;
+  GstBuffer *disk_buf = NULL;
+  GList *link;
 
   GSTCURL_FUNCTION_ENTRY (src);
   ret = GST_FLOW_OK;
@@ -767,76 +1653,186 @@ gst_curl_http_src_create (GstPushSrc * psrc, GstBuffer ** outbuf)
 
 retry:
   if (!src->transfer_begun) {
-    GST_DEBUG_OBJECT (src, "Starting new request for URI %s", src->uri);
-    /* Create the Easy Handle and set up the session. */
-    src->curl_handle = gst_curl_http_src_create_easy_handle (src);
+    /* We might have some or all of it already */
+    if ((gst_curl_http_src_serve_cached (src) == FALSE) &&
+        (gst_curl_http_src_adopt_prefetch (src) == GST_FLOW_FLUSHING)) {
+      ret = GST_FLOW_FLUSHING;
+      goto escape;
+    }
+  }
 
-    g_mutex_lock (&klass->multi_task_context.mutex);
+  if (!src->transfer_begun) {
+    GST_DEBUG_OBJECT (src, "Starting new request for URI %s", src->uri);
+    /* Pick up whatever pool was negotiated before curl starts writing */
+    if (src->pool != NULL) {
+      gst_object_unref (src->pool);
+    }
+    src->pool = gst_base_src_get_buffer_pool (GST_BASE_SRC (src));
+    src->block_size = gst_base_src_get_blocksize (GST_BASE_SRC (src));
+    gst_curl_http_src_drop_cache_body (src);
 
-    if (gst_curl_http_src_add_queue_item (&klass->multi_task_context.queue, src)
-        == FALSE) {
-      GST_ERROR_OBJECT (src, "Couldn't create new queue item! Aborting...");
-      return GST_FLOW_ERROR;
+    /*
+     * For a parallel download, start off with just the first part. A retry
+     * of that carries on to the same place.
+     */
+    if ((src->parallel_ranges > 1) && (src->stop_position == -1) &&
+        (src->seekable == TRUE) && (src->parallel_disabled == FALSE)) {
+      if (src->transfer_stop == -1) {
+        src->transfer_stop =
+            src->request_position + GSTCURL_PARALLEL_PART_SIZE;
+        src->next_part_start = src->transfer_stop;
+      }
+    } else {
+      src->transfer_stop = src->stop_position;
     }
 
-    /* Signal the worker thread */
-    klass->multi_task_context.state = GSTCURL_MULTI_LOOP_STATE_QUEUE_EVENT;
-    g_cond_signal (&klass->multi_task_context.signal);
-    g_mutex_unlock (&klass->multi_task_context.mutex);
+    /* Create the Easy Handle and set up the session. */
+    src->curl_handle = gst_curl_http_src_create_easy_handle (src);
 
     src->state = GSTCURL_OK;
     src->transfer_begun = TRUE;
     src->data_received = FALSE;
-
-    GST_DEBUG_OBJECT (src, "Submitted request for URI %s to curl", src->uri);
-
+    src->paused = FALSE;
+    src->curl_result = CURLE_OK;
+    src->bandwidth_sample_start = 0;
+    gst_curl_http_src_bucket_set_rate (&src->bucket, src->max_rate / 8);
+    src->host_bucket = NULL;
+
+    if (src->http_headers != NULL) {
+      gst_structure_free (src->http_headers);
+    }
     src->http_headers = gst_structure_new (HTTP_HEADERS_NAME,
         URI_NAME, G_TYPE_STRING, src->uri,
         REQUEST_HEADERS_NAME, GST_TYPE_STRUCTURE, src->request_headers,
         RESPONSE_HEADERS_NAME, GST_TYPE_STRUCTURE,
         gst_structure_new_empty (RESPONSE_HEADERS_NAME), NULL);
-  }
 
-  /* Wait for data to become available, then punt it downstream */
-  while ((src->buffer_len == 0) && (src->state == GSTCURL_OK)) {
-    g_cond_wait (&src->signal, &src->buffer_mutex);
-  }
-
-  if (src->state == GSTCURL_UNLOCK) {
-    if (src->buffer_len > 0) {
-      g_free (src->buffer);
-      src->buffer = NULL;
-      src->buffer_len = 0;
+    /*
+     * The curl loop takes the context mutex before our buffer_mutex, so let
+     * go of ours while queueing. Everything the callbacks need is set up.
+     */
+    if ((src->context == NULL) || g_queue_is_empty (&src->prefetches)) {
+      /* Prefetches stay with the worker they were handed to, and so do we */
+      src->context = gst_curl_http_src_pick_context (src);
     }
-    ret = GST_FLOW_FLUSHING;
-    goto escape;
-  }
-
-  ret = gst_curl_http_src_handle_response (src);
-  switch (ret) {
+    context = src->context;
+    coalesce = (src->request_position == 0) && (src->transfer_stop == -1) &&
+        (src->stale_body == NULL);
+    g_mutex_unlock (&src->buffer_mutex);
+    g_mutex_lock (&context->mutex);
+
+    /* Share the transfer if someone is already asking for the same thing */
+    if ((coalesce == TRUE) &&
+        (gst_curl_http_src_follow_queue_item (context, src) == TRUE)) {
+      g_mutex_unlock (&context->mutex);
+      g_mutex_lock (&src->buffer_mutex);
+      gst_curl_http_src_destroy_easy_handle (src);
+      GST_DEBUG_OBJECT (src, "Sharing transfer already under way for URI %s",
+          src->uri);
+    } else {
+      gst_curl_http_src_merge_limits (context, src);
+      if (gst_curl_http_src_add_queue_item (&context->pending_queue, src)
+          == FALSE) {
+        GST_ERROR_OBJECT (src, "Couldn't create new queue item! Aborting...");
+        g_mutex_unlock (&context->mutex);
+        return GST_FLOW_ERROR;
+      }
+
+      /* Signal the worker thread */
+      context->state = GSTCURL_MULTI_LOOP_STATE_QUEUE_EVENT;
+      gst_curl_http_src_multi_wakeup (context);
+      g_mutex_unlock (&context->mutex);
+      g_mutex_lock (&src->buffer_mutex);
+
+      GST_DEBUG_OBJECT (src, "Submitted request for URI %s to curl",
+          src->uri);
+    }
+  }
+
+  /*
+   * Wait for data to become available, then punt it downstream. A prefetch
+   * we've taken over leaves data queued up before the rest of it has been
+   * answered for, so wait for the response too.
+   */
+  while (((src->buffer_len == 0) || (src->status_code == 0)) &&
+      (src->state == GSTCURL_OK)) {
+    g_cond_wait (&src->signal, &src->buffer_mutex);
+  }
+
+  if (src->state == GSTCURL_UNLOCK) {
+    gst_curl_http_src_flush_buffer_queue (src);
+    ret = GST_FLOW_FLUSHING;
+    goto escape;
+  }
+
+  /* The stale copy we asked about hasn't changed, so it's as good as new */
+  if ((src->stale_body != NULL) && (src->status_code == 304) &&
+      (src->state == GSTCURL_DONE) && (src->curl_result == CURLE_OK)) {
+    gst_curl_http_src_serve_revalidated (src);
+  }
+
+  ret = gst_curl_http_src_handle_response (src);
+  switch (ret) {
     case GST_FLOW_ERROR:
       goto escape;              /* Don't attempt a retry, just bomb out */
     case GST_FLOW_CUSTOM_ERROR:
-      if (src->data_received == TRUE) {
-        /*
-         * If data has already been received, we can't recall previously sent
-         * buffers so don't attempt a retry in this case.
-         *
-         * TODO: Remember the position we got to, and make a range request for
-         * the resource without the bit we've already received?
-         */
-        GST_WARNING_OBJECT (src,
-            "Failed mid-transfer, can't continue for URI %s", src->uri);
-        ret = GST_FLOW_ERROR;
-        goto escape;
+      /*
+       * Everything up to resume_position has either gone downstream or is
+       * still queued up here, so that's where a retry needs to pick up from.
+       */
+      resume_position = src->read_position + src->buffer_len;
+      if (((src->have_size == TRUE) &&
+              (resume_position >= src->content_size)) ||
+          (resume_position >= src->transfer_stop)) {
+        /* It only fell over after we had it all, so just finish it off */
+        GST_INFO_OBJECT (src, "Transfer failed after the last byte, ignoring");
+        src->curl_result = CURLE_OK;
+        ret = GST_FLOW_OK;
+        break;
+      }
+      if ((resume_position > src->request_position) &&
+          (src->seekable == FALSE)) {
+        if (src->data_received == TRUE) {
+          /* We can't recall previously sent buffers, so give up */
+          GST_WARNING_OBJECT (src,
+              "Failed mid-transfer, can't continue for URI %s", src->uri);
+          ret = GST_FLOW_ERROR;
+          goto escape;
+        }
+        /* Nothing has gone downstream yet, so start again from scratch */
+        gst_curl_http_src_flush_buffer_queue (src);
+        resume_position = src->request_position;
       }
+      if (resume_position > src->request_position) {
+        /* We got further this time, so don't count earlier failures */
+        src->retries_remaining = src->total_retries;
+      }
+#ifdef CURL_VERSION_HTTP3
+      /*
+       * Older curl won't fall back from HTTP/3 itself, so if we never got a
+       * response that way, try again over HTTP/2 without it counting.
+       */
+      if ((src->preferred_http_version == GSTCURL_HTTP_VERSION_3_0) &&
+          (src->http3_failed == FALSE) && (src->status_code == 0)) {
+        GST_INFO_OBJECT (src, "No response over HTTP/3 for URI %s, falling "
+            "back to HTTP/2", src->uri);
+        src->http3_failed = TRUE;
+        src->retries_remaining++;
+      }
+#endif
       src->retries_remaining--;
       if (src->retries_remaining == 0) {
         GST_WARNING_OBJECT (src, "Out of retries for URI %s", src->uri);
         ret = GST_FLOW_ERROR;   /* Don't attempt a retry, just bomb out */
         goto escape;
       }
-      GST_INFO_OBJECT (src, "Attempting retry for URI %s", src->uri);
+      if (resume_position > src->request_position) {
+        GST_INFO_OBJECT (src, "Resuming transfer for URI %s from byte %"
+            G_GUINT64_FORMAT, src->uri, resume_position);
+        src->request_position = resume_position;
+      } else {
+        GST_INFO_OBJECT (src, "Attempting retry for URI %s", src->uri);
+      }
       src->state = GSTCURL_NONE;
       src->transfer_begun = FALSE;
       src->status_code = 0;
@@ -846,30 +1842,98 @@ retry:
         src->http_headers = NULL;
       }
       gst_curl_http_src_destroy_easy_handle (src);
-      g_mutex_unlock (&src->buffer_mutex);
       goto retry;               /* Attempt a retry! */
     default:
+      /* Now we might know enough to start on the rest in parallel */
+      gst_curl_http_src_plan_parts (src);
       break;
   }
 
   if (((src->state == GSTCURL_OK) || (src->state == GSTCURL_DONE)) &&
       (src->buffer_len > 0)) {
 
-    GST_DEBUG_OBJECT (src, "Pushing %u bytes of transfer for URI %s to pad",
-        src->buffer_len, src->uri);
-    *outbuf = gst_buffer_new_allocate (NULL, src->buffer_len, NULL);
-    gst_buffer_fill (*outbuf, 0, src->buffer, src->buffer_len);
-
-    g_free (src->buffer);
-    src->buffer = NULL;
-    src->buffer_len = 0;
+    /*
+     * Hand over the oldest full block. If nothing has filled up yet, give away
+     * the partially filled one rather than sitting on the data.
+     */
+    if (g_queue_is_empty (&src->buffer_queue)) {
+      gst_curl_http_src_close_block (src);
+    }
+    /* Blocks of a shared transfer can be shared with other sources */
+    *outbuf = gst_buffer_make_writable (g_queue_pop_head (&src->buffer_queue));
+    src->buffer_len -= gst_buffer_get_size (*outbuf);
     src->data_received = TRUE;
 
+    GST_BUFFER_OFFSET (*outbuf) = src->read_position;
+    src->read_position += gst_buffer_get_size (*outbuf);
+    GST_BUFFER_OFFSET_END (*outbuf) = src->read_position;
+
+    GST_DEBUG_OBJECT (src, "Pushing %" G_GSIZE_FORMAT " bytes of transfer for "
+        "URI %s to pad", gst_buffer_get_size (*outbuf), src->uri);
+
+    /* Keep a copy of anything that's going into the caches */
+    if (src->cache_headers != NULL) {
+      if (gst_curl_http_src_keep_cached (src, *outbuf) == TRUE) {
+        disk_buf = gst_buffer_ref (*outbuf);
+      }
+    }
+
+    /* Let curl carry on once we've drained down to the low watermark */
+    if ((src->paused == TRUE) &&
+        (src->buffer_len <= (src->max_buffer_bytes / 2))) {
+      GST_DEBUG_OBJECT (src, "Buffer drained, resuming transfer");
+      src->paused = FALSE;
+      unpause = TRUE;
+    }
+
     /* ret should still be GST_FLOW_OK */
+  } else if ((src->state == GSTCURL_DONE) && (src->buffer_len == 0) &&
+      (src->transfer_stop != src->stop_position) &&
+      (src->read_position == src->transfer_stop) && (src->seekable == TRUE)) {
+    /*
+     * That was only the first part of a parallel download. Carry on with the
+     * parts fetching the rest, or if they couldn't be set up because we don't
+     * know how big it is, with a single transfer for all that's left.
+     */
+    ret = gst_curl_http_src_next_part_buffer (src, outbuf);
+    if (ret == GST_FLOW_OK) {
+      GST_BUFFER_OFFSET (*outbuf) = src->read_position;
+      src->read_position += gst_buffer_get_size (*outbuf);
+      GST_BUFFER_OFFSET_END (*outbuf) = src->read_position;
+      src->data_received = TRUE;
+    } else if ((ret == GST_FLOW_EOS) && (src->have_size == FALSE)) {
+      GST_INFO_OBJECT (src, "Size unknown, fetching the rest of URI %s in one "
+          "go", src->uri);
+      src->parallel_disabled = TRUE;
+      src->request_position = src->read_position;
+      src->transfer_stop = -1;
+      src->state = GSTCURL_NONE;
+      src->transfer_begun = FALSE;
+      src->status_code = 0;
+      src->hdrs_updated = FALSE;
+      gst_curl_http_src_destroy_easy_handle (src);
+      goto retry;
+    } else if (ret == GST_FLOW_EOS) {
+      GST_INFO_OBJECT (src, "All parts received, signalling EOS for URI %s.",
+          src->uri);
+      gst_curl_http_src_publish_timing (src);
+      src->state = GSTCURL_NONE;
+      src->transfer_begun = FALSE;
+      src->transfer_stop = -1;
+      src->status_code = 0;
+      src->hdrs_updated = FALSE;
+      gst_curl_http_src_destroy_easy_handle (src);
+    }
   } else if ((src->state == GSTCURL_DONE) && (src->buffer_len == 0)) {
     GST_INFO_OBJECT (src, "Full body received, signalling EOS for URI %s.",
         src->uri);
+    if (src->cache_headers != NULL) {
+      disk_commit = gst_curl_http_src_store_cached (src);
+    }
+    gst_curl_http_src_drop_stale (src);
+    gst_curl_http_src_publish_timing (src);
     src->state = GSTCURL_NONE;
+    src->transfer_stop = -1;
     src->transfer_begun = FALSE;
     src->status_code = 0;
     src->hdrs_updated = FALSE;
@@ -901,8 +1965,33 @@ retry:
   }
 
 escape:
+  /* Parts we've set up while holding the lock still need handing to curl */
+  for (link = src->parts.head; link != NULL; link = link->next) {
+    GstCurlHttpSrcPart *part = link->data;
+    if ((part->queued == FALSE) && (part->done == FALSE)) {
+      submit = TRUE;
+      break;
+    }
+  }
   g_mutex_unlock (&src->buffer_mutex);
 
+  /* Nobody should wait on the disk for us to let go of the buffer_mutex */
+  if (disk_buf != NULL) {
+    gst_curl_http_src_write_cached (src, disk_buf);
+    gst_buffer_unref (disk_buf);
+  }
+  if (disk_commit != NULL) {
+    gst_curl_http_src_commit_cached (src, disk_commit);
+  }
+
+  /* Can't hold the buffer_mutex here, curl will call back into get_chunks */
+  if (unpause == TRUE) {
+    gst_curl_http_src_request_unpause (src);
+  }
+  if (submit == TRUE) {
+    gst_curl_http_src_submit_parts (src);
+  }
+
   GSTCURL_FUNCTION_EXIT (src);
   return ret;
 }
@@ -928,22 +2017,102 @@ _headers_to_curl_slist (GQuark field_id, const GValue * value, gpointer ptr)
 }
 
 /*
- * From the data in the queue element s, create a CURL easy handle and populate
- * options with the URL, proxy data, login options, cookies,
+ * Create the CURL easy handle for the element's own transfer, from the
+ * request position up to the transfer's stop.
  */
 static CURL *
 gst_curl_http_src_create_easy_handle (GstCurlHttpSrc * s)
 {
   CURL *handle;
+
+  handle = gst_curl_http_src_new_easy_handle (s, s->request_position,
+      s->transfer_stop, &s->slist);
+  if (handle == NULL) {
+    return NULL;
+  }
+
+  /* Only have a stale copy from the cache sent again if it has changed */
+  if ((s->stale_headers != NULL) && (s->request_position == 0)) {
+    const gchar *value;
+    gchar *header;
+
+    value = gst_structure_get_string (s->stale_headers, "etag");
+    if (value != NULL) {
+      header = g_strstrip (g_strdup_printf ("If-None-Match: %s", value));
+      s->slist = curl_slist_append (s->slist, header);
+      g_free (header);
+    }
+    value = gst_structure_get_string (s->stale_headers, "last-modified");
+    if (value != NULL) {
+      header = g_strstrip (g_strdup_printf ("If-Modified-Since: %s", value));
+      s->slist = curl_slist_append (s->slist, header);
+      g_free (header);
+    }
+    curl_easy_setopt (handle, CURLOPT_HTTPHEADER, s->slist);
+  }
+
+  curl_easy_setopt (handle, CURLOPT_HEADERFUNCTION,
+      gst_curl_http_src_get_header);
+  curl_easy_setopt (handle, CURLOPT_HEADERDATA, s);
+  curl_easy_setopt (handle, CURLOPT_WRITEFUNCTION,
+      gst_curl_http_src_get_chunks);
+  curl_easy_setopt (handle, CURLOPT_WRITEDATA, s);
+
+  curl_easy_setopt (handle, CURLOPT_ERRORBUFFER, s->curl_errbuf);
+
+  return handle;
+}
+
+/*
+ * Weight a handle's HTTP/2 stream by priority, against the other streams on
+ * its connection. Has no effect on HTTP/1.x.
+ */
+static void
+gst_curl_http_src_set_stream_weight (GstCurlHttpSrc * s, CURL * handle,
+    GstCurlHttpSrcPriority priority)
+{
+#if LIBCURL_VERSION_NUM >= 0x072e00
+  long weight;
+
+  switch (priority) {
+    case GST_CURL_HTTP_SRC_PRIORITY_HIGH:
+      weight = GSTCURL_STREAM_WEIGHT_HIGH;
+      break;
+    case GST_CURL_HTTP_SRC_PRIORITY_LOW:
+      weight = GSTCURL_STREAM_WEIGHT_LOW;
+      break;
+    default:
+      weight = GSTCURL_STREAM_WEIGHT_NORMAL;
+      break;
+  }
+  if (curl_easy_setopt (handle, CURLOPT_STREAM_WEIGHT, weight) != CURLE_OK) {
+    GST_WARNING_OBJECT (s, "Cannot set unsupported option %s",
+        "CURLOPT_STREAM_WEIGHT");
+  }
+#endif
+}
+
+/*
+ * From the data in s, create a CURL easy handle and populate options with the
+ * URL, proxy data, login options, cookies, and a range from start up to stop
+ * (-1 for the end). Extra request headers are appended to slist, which the
+ * caller must free. Callbacks are left for the caller to set up.
+ */
+static CURL *
+gst_curl_http_src_new_easy_handle (GstCurlHttpSrc * s, guint64 start,
+    guint64 stop, struct curl_slist **slist)
+{
+  CURL *handle;
+  GstCurlHttpSrcClass *klass;
   gint i;
   GSTCURL_FUNCTION_ENTRY (s);
 
-  handle = curl_easy_init ();
+  handle = gst_curl_http_src_get_pooled_handle (s);
   if (handle == NULL) {
     GST_ERROR_OBJECT (s, "Couldn't init a curl easy handle!");
     return NULL;
   }
-  GST_INFO_OBJECT (s, "Creating a new handle for URI %s", s->uri);
+  GST_INFO_OBJECT (s, "Setting up a handle for URI %s", s->uri);
 
   /* This is mandatory and yet not default option, so if this is NULL
    * then something very bad is going on. */
@@ -963,8 +2132,7 @@ gst_curl_http_src_create_easy_handle (GstCurlHttpSrc * s)
   /* curl_slist_append dynamically allocates memory, but I need to free it */
   if (s->request_headers != NULL) {
     gst_structure_foreach (s->request_headers, _headers_to_curl_slist,
-        &s->slist);
-    curl_easy_setopt (handle, CURLOPT_HTTPHEADER, s->slist);
+        slist);
   }
 
   gst_curl_setopt_str_default (s, handle, CURLOPT_USERAGENT, s->user_agent);
@@ -987,6 +2155,11 @@ gst_curl_http_src_create_easy_handle (GstCurlHttpSrc * s)
   gst_curl_setopt_int (s, handle, CURLOPT_TCP_KEEPALIVE,
       GSTCURL_BINARYBOOL (s->keep_alive));
   gst_curl_setopt_int (s, handle, CURLOPT_TIMEOUT, s->timeout_secs);
+#if LIBCURL_VERSION_NUM >= 0x074100
+  /* Idle connections older than this aren't reused, from curl 7.65.0 */
+  gst_curl_setopt_int (s, handle, CURLOPT_MAXAGE_CONN,
+      (long) s->max_connection_time);
+#endif
   gst_curl_setopt_int (s, handle, CURLOPT_SSL_VERIFYPEER,
       GSTCURL_BINARYBOOL (s->strict_ssl));
   gst_curl_setopt_str (s, handle, CURLOPT_CAINFO, s->custom_ca_file);
@@ -1006,21 +2179,93 @@ gst_curl_http_src_create_easy_handle (GstCurlHttpSrc * s)
     case GSTCURL_HTTP_VERSION_2_0:
       GST_DEBUG_OBJECT (s, "Setting version as HTTP/2.0");
       curl_easy_setopt (handle, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_2_0);
+#if LIBCURL_VERSION_NUM >= 0x072b00
+      /* Wait to share a connection that's on its way rather than open more */
+      curl_easy_setopt (handle, CURLOPT_PIPEWAIT, 1L);
+#endif
+      break;
+#endif
+#ifdef CURL_VERSION_HTTP3
+    case GSTCURL_HTTP_VERSION_3_0:
+      if (s->http3_failed == TRUE) {
+        GST_DEBUG_OBJECT (s, "HTTP/3 failed before, setting version as 2.0");
+        curl_easy_setopt (handle, CURLOPT_HTTP_VERSION,
+            CURL_HTTP_VERSION_2_0);
+      } else {
+        GST_DEBUG_OBJECT (s, "Setting version as HTTP/3");
+        curl_easy_setopt (handle, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_3);
+      }
+      curl_easy_setopt (handle, CURLOPT_PIPEWAIT, 1L);
+      /* Let servers that advertise HTTP/3 get it next time round */
+      klass = G_TYPE_INSTANCE_GET_CLASS (s, GST_TYPE_CURL_HTTP_SRC,
+          GstCurlHttpSrcClass);
+      if (klass->altsvc_file != NULL) {
+        static gsize altsvc_dir_made = 0;
+
+        if (g_once_init_enter (&altsvc_dir_made)) {
+          gchar *dir = g_path_get_dirname (klass->altsvc_file);
+
+          g_mkdir_with_parents (dir, 0700);
+          g_free (dir);
+          g_once_init_leave (&altsvc_dir_made, 1);
+        }
+        curl_easy_setopt (handle, CURLOPT_ALTSVC_CTRL,
+            (long) (CURLALTSVC_H1 | CURLALTSVC_H2 | CURLALTSVC_H3));
+        curl_easy_setopt (handle, CURLOPT_ALTSVC, klass->altsvc_file);
+      }
       break;
 #endif
     default:
       GST_WARNING_OBJECT (s,
           "Supplied a bogus HTTP version, using curl default!");
   }
+  gst_curl_http_src_set_stream_weight (s, handle, s->priority);
 
-  curl_easy_setopt (handle, CURLOPT_HEADERFUNCTION,
-      gst_curl_http_src_get_header);
-  curl_easy_setopt (handle, CURLOPT_HEADERDATA, s);
-  curl_easy_setopt (handle, CURLOPT_WRITEFUNCTION,
-      gst_curl_http_src_get_chunks);
-  curl_easy_setopt (handle, CURLOPT_WRITEDATA, s);
+  /* Only ask for a range if we've been seeked, or told where to stop */
+  if ((start > 0) || (stop != -1)) {
+    gchar *range;
 
-  curl_easy_setopt (handle, CURLOPT_ERRORBUFFER, s->curl_errbuf);
+    if (stop != -1) {
+      /* Segment stops are exclusive, HTTP range ends aren't */
+      range = g_strdup_printf ("%" G_GUINT64_FORMAT "-%" G_GUINT64_FORMAT,
+          start, stop - 1);
+    } else {
+      range = g_strdup_printf ("%" G_GUINT64_FORMAT "-", start);
+    }
+    GST_DEBUG_OBJECT (s, "Requesting range %s", range);
+    /* curl takes its own copy of the string */
+    curl_easy_setopt (handle, CURLOPT_RANGE, range);
+    g_free (range);
+
+    /*
+     * Make sure we're still reading what we started on. If it has changed the
+     * server sends the whole thing with a 200 instead. Weak ETags can't be
+     * used for this, so fall back to the modification date for those.
+     */
+    if (start > 0) {
+      gchar *if_range = NULL;
+
+      if ((s->etag != NULL) && (g_str_has_prefix (s->etag, "W/") == FALSE)) {
+        if_range = g_strdup_printf ("If-Range: %s", s->etag);
+      } else if (s->last_modified != NULL) {
+        if_range = g_strdup_printf ("If-Range: %s", s->last_modified);
+      }
+      if (if_range != NULL) {
+        *slist = curl_slist_append (*slist, if_range);
+        g_free (if_range);
+      }
+    }
+  }
+
+  if (*slist != NULL) {
+    curl_easy_setopt (handle, CURLOPT_HTTPHEADER, *slist);
+  }
+
+  klass = G_TYPE_INSTANCE_GET_CLASS (s, GST_TYPE_CURL_HTTP_SRC,
+      GstCurlHttpSrcClass);
+  if (klass->share_handle != NULL) {
+    curl_easy_setopt (handle, CURLOPT_SHARE, klass->share_handle);
+  }
 
   GSTCURL_FUNCTION_EXIT (s);
   return handle;
@@ -1051,6 +2296,14 @@ gst_curl_http_src_handle_response (GstCurlHttpSrc * src)
     GST_WARNING_OBJECT (src, "Curl failed the transfer (%d): %s",
         src->curl_result, curl_easy_strerror (src->curl_result));
     GST_DEBUG_OBJECT (src, "Reason for curl failure: %s", src->curl_errbuf);
+#ifdef CURL_VERSION_HTTP3
+    if (gst_curl_http_src_http3_fallback (src) == TRUE) {
+      return GST_FLOW_CUSTOM_ERROR;
+    }
+#endif
+    if (gst_curl_http_src_retryable (src->curl_result) == TRUE) {
+      return GST_FLOW_CUSTOM_ERROR;
+    }
     return GST_FLOW_ERROR;
   }
 
@@ -1105,11 +2358,43 @@ gst_curl_http_src_handle_response (GstCurlHttpSrc * src)
   }
 
   /*
-   * Deal with redirections...
+   * A server that doesn't do ranges sends the whole thing back with a 200,
+   * which would land the start of the resource where we seeked to.
+   */
+  if ((src->request_position == 0) && (src->transfer_stop != -1) &&
+      (src->status_code == 200)) {
+    /* We still get the bytes we wanted, but don't count on any more ranges */
+    GST_INFO_OBJECT (src, "Server ignored range request for URI %s",
+        src->uri);
+    src->seekable = FALSE;
+  }
+  if ((src->request_position > 0) && (src->status_code != 206)) {
+    if ((src->etag != NULL) || (src->last_modified != NULL)) {
+      /* We sent If-Range, so it's most likely that the resource changed */
+      GST_WARNING_OBJECT (src, "Resource changed on the server for URI %s",
+          src->uri);
+      GST_ELEMENT_ERROR (src, RESOURCE, READ, ("Resource changed on the "
+              "server, can't continue from byte %" G_GUINT64_FORMAT ", URL: %s",
+              src->request_position, src->uri), (NULL));
+    } else {
+      GST_WARNING_OBJECT (src, "Server ignored range request for URI %s",
+          src->uri);
+      src->seekable = FALSE;
+      GST_ELEMENT_ERROR (src, RESOURCE, SEEK, ("Server does not accept Range "
+              "HTTP header, URL: %s", src->uri), (NULL));
+    }
+    src->retries_remaining = 0;
+    GSTCURL_FUNCTION_EXIT (src);
+    return GST_FLOW_ERROR;
+  }
+
+  /*
+   * Deal with redirections... A response from the cache has no handle, but
+   * it came from the URI we asked for, and we already know its size.
    */
-  if (curl_easy_getinfo (src->curl_handle, CURLINFO_EFFECTIVE_URL,
-          &redirect_url)
-      == CURLE_OK) {
+  if ((src->curl_handle != NULL) &&
+      (curl_easy_getinfo (src->curl_handle, CURLINFO_EFFECTIVE_URL,
+              &redirect_url) == CURLE_OK)) {
     size_t lena, lenb;
     lena = strlen (src->uri);
     lenb = strlen (redirect_url);
@@ -1125,27 +2410,72 @@ gst_curl_http_src_handle_response (GstCurlHttpSrc * src)
   }
 
   /*
-   * Push the content length
+   * Push the content length. For a 206 that only covers the range, so the
+   * size of the whole resource comes from the Content-Range header instead.
    */
-  if (curl_easy_getinfo (src->curl_handle, CURLINFO_CONTENT_LENGTH_DOWNLOAD,
-          &curl_info_dbl) == CURLE_OK) {
+  if ((src->status_code != 206) && (src->curl_handle != NULL) &&
+      (curl_easy_getinfo (src->curl_handle, CURLINFO_CONTENT_LENGTH_DOWNLOAD,
+              &curl_info_dbl) == CURLE_OK)) {
     if (curl_info_dbl == -1) {
       GST_WARNING_OBJECT (src,
           "No Content-Length was specified in the response.");
     } else {
       GST_INFO_OBJECT (src, "Content-Length was given as %.0f", curl_info_dbl);
-      basesrc = GST_BASE_SRC_CAST (src);
-      basesrc->segment.duration = curl_info_dbl;
-      gst_element_post_message (GST_ELEMENT (src),
-          gst_message_new_duration_changed (GST_OBJECT (src)));
+      src->content_size = (guint64) curl_info_dbl;
+      src->have_size = TRUE;
     }
   }
+  if (src->have_size == TRUE) {
+    basesrc = GST_BASE_SRC_CAST (src);
+    basesrc->segment.duration = src->content_size;
+    gst_element_post_message (GST_ELEMENT (src),
+        gst_message_new_duration_changed (GST_OBJECT (src)));
+  }
 
   /*
    * Push all the received headers down via a sicky event
    */
   response_headers = gst_structure_get_value (src->http_headers,
       RESPONSE_HEADERS_NAME);
+
+  /*
+   * If the whole of a response can be cached, keep a copy of it on its way
+   * downstream. One that came out of a cache has no handle, and isn't put
+   * back. The cache directory and the validated responses also take
+   * responses that are stale already but can be revalidated.
+   */
+  if (((src->response_cache == TRUE) || (src->cache_directory != NULL) ||
+          (src->revalidate == TRUE)) &&
+      (src->curl_handle != NULL) && (src->cache_headers == NULL) &&
+      (src->data_received == FALSE) && (src->status_code == 200) &&
+      (src->request_position == 0) && (src->transfer_stop == -1)) {
+    const GstStructure *headers = gst_value_get_structure (response_headers);
+    gboolean shareable = gst_curl_http_src_cache_shareable (headers,
+        gst_curl_http_src_authenticated (src));
+
+    src->cache_lifetime = gst_curl_http_src_cache_lifetime (headers);
+    if (((src->response_cache == TRUE) && (src->cache_lifetime > 0) &&
+            (shareable == TRUE)) ||
+        ((src->revalidate == TRUE) &&
+            gst_curl_http_src_cache_revalidatable (headers))) {
+      src->cache_body = g_byte_array_new ();
+    }
+    if ((src->cache_directory != NULL) && (shareable == TRUE) &&
+        ((src->cache_lifetime > 0) ||
+            gst_curl_http_src_cache_revalidatable (headers))) {
+      src->cache_fd = gst_curl_http_src_disk_cache_begin
+          (src->cache_directory, src->uri, &src->cache_file);
+      src->cache_file_size = 0;
+      if (src->cache_fd < 0) {
+        GST_WARNING_OBJECT (src, "Couldn't write to cache directory %s",
+            src->cache_directory);
+      }
+    }
+    if ((src->cache_body != NULL) || (src->cache_fd >= 0)) {
+      src->cache_headers = gst_structure_copy (headers);
+    }
+  }
+
   if (gst_structure_n_fields (gst_value_get_structure (response_headers)) > 0) {
     GstEvent *hdrs_event;
 
@@ -1218,9 +2548,9 @@ gst_curl_http_src_negotiate_caps (GstCurlHttpSrc * src)
 static inline void
 gst_curl_http_src_destroy_easy_handle (GstCurlHttpSrc * src)
 {
-  /* Thank you Handles, and well done. Well done, mate. */
+  /* Thank you Handles, and well done. Now go and wait for the next one. */
   if (src->curl_handle != NULL) {
-    curl_easy_cleanup (src->curl_handle);
+    gst_curl_http_src_put_pooled_handle (src, src->curl_handle);
     src->curl_handle = NULL;
   }
   /* In addition, clean up the curl header slist if it was used. */
@@ -1230,6 +2560,157 @@ gst_curl_http_src_destroy_easy_handle (GstCurlHttpSrc * src)
   }
 }
 
+/*
+ * Get an easy handle from the shared pool, or make a new one if it's empty.
+ * Pooled handles have been reset, so they need setting up from scratch, but
+ * they keep their caches (connections, DNS, TLS sessions) from last time.
+ */
+static CURL *
+gst_curl_http_src_get_pooled_handle (GstCurlHttpSrc * src)
+{
+  GstCurlHttpSrcClass *klass = G_TYPE_INSTANCE_GET_CLASS (src,
+      GST_TYPE_CURL_HTTP_SRC,
+      GstCurlHttpSrcClass);
+  CURL *handle;
+
+  g_mutex_lock (&klass->handle_pool_mutex);
+  handle = g_queue_pop_head (&klass->handle_pool);
+  if (handle != NULL) {
+    klass->handle_pool_hits++;
+  } else {
+    klass->handle_pool_misses++;
+  }
+  GST_LOG_OBJECT (src, "Handle pool %s (%" G_GUINT64_FORMAT " hits, %"
+      G_GUINT64_FORMAT " misses)", (handle != NULL) ? "hit" : "miss",
+      klass->handle_pool_hits, klass->handle_pool_misses);
+  g_mutex_unlock (&klass->handle_pool_mutex);
+
+  if (handle == NULL) {
+    handle = curl_easy_init ();
+  }
+
+  return handle;
+}
+
+/*
+ * Reset a finished easy handle and give it back to the pool. Must only be
+ * called once curl has let go of it, i.e. it is no longer on a multi handle.
+ */
+static void
+gst_curl_http_src_put_pooled_handle (GstCurlHttpSrc * src, CURL * handle)
+{
+  GstCurlHttpSrcClass *klass = G_TYPE_INSTANCE_GET_CLASS (src,
+      GST_TYPE_CURL_HTTP_SRC,
+      GstCurlHttpSrcClass);
+
+  /*
+   * Resetting leaves the cookie engine alone, so forget any cookies we gave
+   * it or a response set, or they go out with whoever has the handle next.
+   */
+  curl_easy_setopt (handle, CURLOPT_COOKIELIST, "ALL");
+
+#ifdef CURL_VERSION_HTTP3
+  /*
+   * curl only writes out the Alt-Svc cache when the handle is cleaned up, so
+   * don't keep any that might have learnt something.
+   */
+  if ((src->preferred_http_version == GSTCURL_HTTP_VERSION_3_0) &&
+      (klass->altsvc_file != NULL)) {
+    curl_easy_cleanup (handle);
+    return;
+  }
+#endif
+  curl_easy_reset (handle);
+
+  g_mutex_lock (&klass->handle_pool_mutex);
+  if (g_queue_get_length (&klass->handle_pool) < GSTCURL_MAX_POOLED_HANDLES) {
+    g_queue_push_head (&klass->handle_pool, handle);
+    handle = NULL;
+  }
+  g_mutex_unlock (&klass->handle_pool_mutex);
+
+  if (handle != NULL) {
+    curl_easy_cleanup (handle);
+  }
+}
+
+/*
+ * Drop any received chunks that haven't yet been pushed downstream. Must be
+ * called with the buffer_mutex held (or once nothing else can touch it).
+ */
+static void
+gst_curl_http_src_flush_buffer_queue (GstCurlHttpSrc * src)
+{
+  GstBuffer *chunk;
+
+  if (src->block != NULL) {
+    gst_buffer_unmap (src->block, &src->block_map);
+    gst_buffer_unref (src->block);
+    src->block = NULL;
+    src->block_fill = 0;
+  }
+  while ((chunk = g_queue_pop_head (&src->buffer_queue)) != NULL) {
+    gst_buffer_unref (chunk);
+  }
+  src->buffer_len = 0;
+}
+
+/*
+ * Start filling a new receive block. Take one from the pool if it has one
+ * spare; this runs on the curl thread so it must never wait for the pool, and
+ * falls back to a plain allocation instead. Called with the buffer_mutex held.
+ */
+static gboolean
+gst_curl_http_src_open_block (GstCurlHttpSrc * src)
+{
+  GstFlowReturn fret = GST_FLOW_EOS;
+  GstBufferPoolAcquireParams params = { 0, };
+
+  if (src->pool != NULL) {
+    params.flags = GST_BUFFER_POOL_ACQUIRE_FLAG_DONTWAIT;
+    fret = gst_buffer_pool_acquire_buffer (src->pool, &src->block, &params);
+  }
+  if (fret != GST_FLOW_OK) {
+    GST_LOG_OBJECT (src, "No pooled block available, allocating %u bytes",
+        src->block_size);
+    src->block = gst_buffer_new_allocate (NULL, src->block_size, NULL);
+    if (src->block == NULL) {
+      return FALSE;
+    }
+  }
+
+  if (gst_buffer_map (src->block, &src->block_map, GST_MAP_WRITE) == FALSE) {
+    gst_buffer_unref (src->block);
+    src->block = NULL;
+    return FALSE;
+  }
+  src->block_fill = 0;
+
+  return TRUE;
+}
+
+/*
+ * Finish off the block currently being filled, trim it to the amount of data
+ * it holds and queue it for ::create(). Called with the buffer_mutex held.
+ */
+static void
+gst_curl_http_src_close_block (GstCurlHttpSrc * src)
+{
+  if (src->block == NULL) {
+    return;
+  }
+
+  gst_buffer_unmap (src->block, &src->block_map);
+  if (src->block_fill == 0) {
+    gst_buffer_unref (src->block);
+  } else {
+    gst_buffer_set_size (src->block, src->block_fill);
+    g_queue_push_tail (&src->buffer_queue, src->block);
+  }
+  src->block = NULL;
+  src->block_fill = 0;
+}
+
 static GstStateChangeReturn
 gst_curl_http_src_change_state (GstElement * element, GstStateChange transition)
 {
@@ -1242,8 +2723,12 @@ gst_curl_http_src_change_state (GstElement * element, GstStateChange transition)
       gst_curl_http_src_ref_multi (source);
       break;
     case GST_STATE_CHANGE_READY_TO_NULL:
-      /* The pipeline has ended, so signal any running request to end. */
-      gst_curl_http_src_request_remove (source);
+      /*
+       * The pipeline has ended, so end any running request, and make sure
+       * curl has let go of everything before the worker might go away.
+       */
+      gst_curl_http_src_abort_transfer (source);
+      gst_curl_http_src_cancel_prefetches (source);
       gst_curl_http_src_unref_multi (source);
       break;
     default:
@@ -1257,13 +2742,1150 @@ gst_curl_http_src_change_state (GstElement * element, GstStateChange transition)
 }
 
 /*
- * Take care of any memory that may be left over from the instance that's now
- * closing before we leak it.
+ * Set up parts to fetch the rest of a parallel download, as long as we know
+ * how big it is and there are connections to spare. Parts that have finished
+ * but haven't gone downstream yet count too, which keeps the memory they use
+ * bounded. Called with the buffer_mutex held; the new parts still have to be
+ * handed to curl with gst_curl_http_src_submit_parts() once it's released.
  */
-static void
-gst_curl_http_src_cleanup_instance (GstCurlHttpSrc * src)
+static gboolean
+gst_curl_http_src_plan_parts (GstCurlHttpSrc * src)
 {
-  gint i;
+  GstCurlHttpSrcPart *part;
+  guint busy;
+  gboolean planned = FALSE;
+
+  if ((src->transfer_stop == src->stop_position) || (src->seekable == FALSE) ||
+      (src->have_size == FALSE)) {
+    return FALSE;
+  }
+
+  /* Our own transfer takes up a connection until it's done */
+  busy = g_queue_get_length (&src->parts);
+  if (src->state == GSTCURL_OK) {
+    busy++;
+  }
+
+  while ((busy < src->parallel_ranges) &&
+      (src->next_part_start < src->content_size)) {
+    part = g_new0 (GstCurlHttpSrcPart, 1);
+    part->src = src;
+    part->start = src->next_part_start;
+    part->stop = MIN (part->start + GSTCURL_PARALLEL_PART_SIZE,
+        src->content_size);
+    g_queue_init (&part->buffers);
+    part->result = CURLE_OK;
+    part->handle = gst_curl_http_src_new_part_handle (src, part);
+    if (part->handle == NULL) {
+      GST_ERROR_OBJECT (src, "Couldn't create a handle for a part!");
+      g_free (part);
+      break;
+    }
+    GST_DEBUG_OBJECT (src, "Planned part %" G_GUINT64_FORMAT "-%"
+        G_GUINT64_FORMAT, part->start, part->stop - 1);
+    g_queue_push_tail (&src->parts, part);
+    src->next_part_start = part->stop;
+    busy++;
+    planned = TRUE;
+  }
+
+  return planned;
+}
+
+/*
+ * Hand any parts or prefetches that curl doesn't have yet to the worker. Must
+ * be called without the buffer_mutex held.
+ */
+static void
+gst_curl_http_src_submit_parts (GstCurlHttpSrc * src)
+{
+  GstCurlHttpSrcMultiTaskContext *context = src->context;
+  GQueue *lists[] = { &src->parts, &src->prefetches };
+  GList *link;
+  gboolean queued = FALSE;
+  guint i;
+
+  if (context == NULL) {
+    return;
+  }
+
+  g_mutex_lock (&context->mutex);
+  g_mutex_lock (&src->buffer_mutex);
+  for (i = 0; i < G_N_ELEMENTS (lists); i++) {
+    for (link = lists[i]->head; link != NULL; link = link->next) {
+      GstCurlHttpSrcPart *part = link->data;
+      if ((part->queued == TRUE) || (part->done == TRUE)) {
+        continue;
+      }
+      if (gst_curl_http_src_add_queue_part (&context->pending_queue, part)
+          == FALSE) {
+        GST_ERROR_OBJECT (src, "Couldn't create new queue item for a part!");
+        part->done = TRUE;
+        part->result = CURLE_OUT_OF_MEMORY;
+        break;
+      }
+      part->queued = TRUE;
+      queued = TRUE;
+    }
+  }
+  g_mutex_unlock (&src->buffer_mutex);
+
+  if (queued == TRUE) {
+    context->state = GSTCURL_MULTI_LOOP_STATE_QUEUE_EVENT;
+    gst_curl_http_src_multi_wakeup (context);
+  }
+  g_mutex_unlock (&context->mutex);
+}
+
+/*
+ * Get the next buffer of a parallel download, from whichever part is first in
+ * line, waiting for it if need be. Finished parts make way for new ones, and
+ * parts that fell over are sent off again for whatever they're missing.
+ * Called with the buffer_mutex held, returns GST_FLOW_EOS when there are no
+ * more parts.
+ */
+static GstFlowReturn
+gst_curl_http_src_next_part_buffer (GstCurlHttpSrc * src, GstBuffer ** outbuf)
+{
+  GstCurlHttpSrcPart *part;
+  GstBuffer *chunk;
+
+  gst_curl_http_src_plan_parts (src);
+
+  while ((part = g_queue_peek_head (&src->parts)) != NULL) {
+    if ((part->queued == FALSE) && (part->done == FALSE)) {
+      /* We've only just set this one up, so curl needs it before we wait */
+      g_mutex_unlock (&src->buffer_mutex);
+      gst_curl_http_src_submit_parts (src);
+      g_mutex_lock (&src->buffer_mutex);
+      continue;
+    }
+    while ((part->len == 0) && (part->done == FALSE) &&
+        (src->state == GSTCURL_DONE)) {
+      g_cond_wait (&src->signal, &src->buffer_mutex);
+    }
+    if (src->state != GSTCURL_DONE) {
+      return GST_FLOW_FLUSHING;
+    }
+
+    if (part->len > 0) {
+      /* curl hands over small chunks, so gather up a block's worth */
+      *outbuf = NULL;
+      while ((part->len > 0) && ((*outbuf == NULL) ||
+              (gst_buffer_get_size (*outbuf) < src->block_size))) {
+        chunk = g_queue_pop_head (&part->buffers);
+        part->len -= gst_buffer_get_size (chunk);
+        *outbuf = (*outbuf == NULL) ? chunk : gst_buffer_append (*outbuf,
+            chunk);
+      }
+      return GST_FLOW_OK;
+    }
+
+    if (part->start < part->stop) {
+      if ((part->result != CURLE_OK) &&
+          (gst_curl_http_src_retryable (part->result) == FALSE)) {
+        GST_WARNING_OBJECT (src, "Part %" G_GUINT64_FORMAT "-%"
+            G_GUINT64_FORMAT " failed (%d): %s", part->start, part->stop - 1,
+            part->result, part->errbuf);
+        return GST_FLOW_ERROR;
+      }
+      src->retries_remaining--;
+      if (src->retries_remaining == 0) {
+        GST_WARNING_OBJECT (src, "Out of retries for URI %s", src->uri);
+        return GST_FLOW_ERROR;
+      }
+      GST_INFO_OBJECT (src, "Retrying part from byte %" G_GUINT64_FORMAT,
+          part->start);
+      gst_curl_http_src_put_pooled_handle (src, part->handle);
+      curl_slist_free_all (part->slist);
+      part->slist = NULL;
+      part->handle = gst_curl_http_src_new_part_handle (src, part);
+      if (part->handle == NULL) {
+        GST_ERROR_OBJECT (src, "Couldn't create a handle for a part!");
+        return GST_FLOW_ERROR;
+      }
+      part->result = CURLE_OK;
+      part->queued = FALSE;
+      part->done = FALSE;
+      continue;
+    }
+
+    /* All of this one has gone downstream, so make room for another */
+    g_queue_pop_head (&src->parts);
+    gst_curl_http_src_free_part (src, part);
+    gst_curl_http_src_plan_parts (src);
+  }
+
+  return GST_FLOW_EOS;
+}
+
+/*
+ * Create the easy handle for a part, asking for whatever it is still missing.
+ */
+static CURL *
+gst_curl_http_src_new_part_handle (GstCurlHttpSrc * src,
+    GstCurlHttpSrcPart * part)
+{
+  CURL *handle;
+
+  handle = gst_curl_http_src_new_easy_handle (src, part->start, part->stop,
+      &part->slist);
+  if (handle == NULL) {
+    return NULL;
+  }
+
+  curl_easy_setopt (handle, CURLOPT_WRITEFUNCTION,
+      gst_curl_http_src_get_part_chunks);
+  curl_easy_setopt (handle, CURLOPT_WRITEDATA, part);
+  curl_easy_setopt (handle, CURLOPT_ERRORBUFFER, part->errbuf);
+
+  return handle;
+}
+
+/*
+ * Does curl still have hold of any of these parts? Called with the
+ * buffer_mutex held.
+ */
+static gboolean
+gst_curl_http_src_parts_running (GQueue * parts)
+{
+  GList *link;
+
+  for (link = parts->head; link != NULL; link = link->next) {
+    GstCurlHttpSrcPart *part = link->data;
+    if ((part->queued == TRUE) && (part->done == FALSE)) {
+      return TRUE;
+    }
+  }
+
+  return FALSE;
+}
+
+/*
+ * Throw away all the parts. curl mustn't have hold of any of them, see
+ * gst_curl_http_src_parts_running().
+ */
+static void
+gst_curl_http_src_free_parts (GstCurlHttpSrc * src)
+{
+  GstCurlHttpSrcPart *part;
+
+  while ((part = g_queue_pop_head (&src->parts)) != NULL) {
+    gst_curl_http_src_free_part (src, part);
+  }
+}
+
+/*
+ * Free a single part or prefetch, along with anything it hasn't handed over.
+ */
+static void
+gst_curl_http_src_free_part (GstCurlHttpSrc * src, GstCurlHttpSrcPart * part)
+{
+  GstBuffer *chunk;
+
+  while ((chunk = g_queue_pop_head (&part->buffers)) != NULL) {
+    gst_buffer_unref (chunk);
+  }
+  if (part->handle != NULL) {
+    gst_curl_http_src_put_pooled_handle (src, part->handle);
+  }
+  if (part->slist != NULL) {
+    curl_slist_free_all (part->slist);
+  }
+  g_free (part->uri);
+  if (part->headers != NULL) {
+    gst_structure_free (part->headers);
+  }
+  g_free (part);
+}
+
+/*
+ * Replace the URIs being prefetched. Those that are no longer wanted get
+ * dropped, and any new ones are handed to curl straight away.
+ */
+static void
+gst_curl_http_src_set_prefetch_uris (GstCurlHttpSrc * src, gchar ** uris)
+{
+  GstCurlHttpSrcMultiTaskContext *context;
+  GstCurlHttpSrcPart *prefetch;
+  GList *link;
+  gboolean wanted;
+  guint i, n_uris = 0;
+
+  if (GST_STATE (src) == GST_STATE_NULL) {
+    /* The curl workers only run while we're at least READY */
+    GST_WARNING_OBJECT (src, "Can't prefetch before going to READY");
+    return;
+  }
+
+  while ((uris != NULL) && (uris[n_uris] != NULL) &&
+      (n_uris < GSTCURL_MAX_PREFETCH_URIS)) {
+    n_uris++;
+  }
+
+  /* The curl loop takes the context mutex before our buffer_mutex */
+  g_mutex_lock (&src->buffer_mutex);
+  context = src->context;
+  g_mutex_unlock (&src->buffer_mutex);
+  if (context == NULL) {
+    context = gst_curl_http_src_pick_context (src);
+  }
+
+  g_mutex_lock (&src->buffer_mutex);
+  if (src->context == NULL) {
+    src->context = context;
+  }
+
+  for (link = src->prefetches.head; link != NULL; link = link->next) {
+    prefetch = link->data;
+    wanted = FALSE;
+    for (i = 0; i < n_uris; i++) {
+      wanted |= (g_strcmp0 (uris[i], prefetch->uri) == 0);
+    }
+    if ((wanted == FALSE) && (prefetch->cancelled == FALSE)) {
+      GST_DEBUG_OBJECT (src, "No longer prefetching URI %s", prefetch->uri);
+      prefetch->cancelled = TRUE;
+    }
+  }
+  gst_curl_http_src_reap_prefetches (src);
+
+  for (i = 0; i < n_uris; i++) {
+    wanted = TRUE;
+    for (link = src->prefetches.head; link != NULL; link = link->next) {
+      prefetch = link->data;
+      if ((prefetch->cancelled == FALSE) &&
+          (g_strcmp0 (uris[i], prefetch->uri) == 0)) {
+        wanted = FALSE;
+      }
+    }
+    if (wanted == FALSE) {
+      continue;
+    }
+
+    prefetch = g_new0 (GstCurlHttpSrcPart, 1);
+    prefetch->src = src;
+    prefetch->uri = g_strdup (uris[i]);
+    prefetch->stop = -1;
+    g_queue_init (&prefetch->buffers);
+    prefetch->headers = gst_structure_new_empty (RESPONSE_HEADERS_NAME);
+    prefetch->result = CURLE_OK;
+    prefetch->handle = gst_curl_http_src_new_prefetch_handle (src, prefetch);
+    if (prefetch->handle == NULL) {
+      GST_ERROR_OBJECT (src, "Couldn't create a handle to prefetch URI %s",
+          prefetch->uri);
+      gst_curl_http_src_free_part (src, prefetch);
+      continue;
+    }
+    GST_DEBUG_OBJECT (src, "Prefetching URI %s", prefetch->uri);
+    g_queue_push_tail (&src->prefetches, prefetch);
+  }
+  g_mutex_unlock (&src->buffer_mutex);
+
+  gst_curl_http_src_submit_parts (src);
+}
+
+/*
+ * If the URI we're about to fetch has been prefetched, take over whatever we
+ * got of it, waiting for the prefetch to finish first. A complete response
+ * stands in for our own transfer, otherwise the transfer carries on from where
+ * the prefetch stopped. Called with the buffer_mutex held before a new
+ * transfer starts. Returns GST_FLOW_OK if a prefetch was taken over,
+ * GST_FLOW_FLUSHING if we got unlocked while waiting for it, or
+ * GST_FLOW_CUSTOM_SUCCESS if there was nothing to take.
+ */
+static GstFlowReturn
+gst_curl_http_src_adopt_prefetch (GstCurlHttpSrc * src)
+{
+  GstCurlHttpSrcPart *prefetch = NULL;
+  const gchar *value;
+  GstBuffer *chunk;
+  gboolean complete, ranges;
+  GList *link;
+
+  gst_curl_http_src_reap_prefetches (src);
+
+  /* Prefetches only ever have the start of a resource */
+  if ((src->request_position != 0) || (src->stop_position != -1) ||
+      (src->read_position != 0) || (src->buffer_len != 0)) {
+    return GST_FLOW_CUSTOM_SUCCESS;
+  }
+  for (link = src->prefetches.head; link != NULL; link = link->next) {
+    GstCurlHttpSrcPart *candidate = link->data;
+    if ((candidate->cancelled == FALSE) &&
+        (g_strcmp0 (candidate->uri, src->uri) == 0)) {
+      prefetch = candidate;
+      break;
+    }
+  }
+  if (prefetch == NULL) {
+    return GST_FLOW_CUSTOM_SUCCESS;
+  }
+
+  /* It can't run for long, it stops at max-buffer-bytes */
+  while ((prefetch->done == FALSE) && (src->state != GSTCURL_UNLOCK)) {
+    g_cond_wait (&src->signal, &src->buffer_mutex);
+  }
+  if (src->state == GSTCURL_UNLOCK) {
+    return GST_FLOW_FLUSHING;
+  }
+  g_queue_remove (&src->prefetches, prefetch);
+
+  complete = ((prefetch->result == CURLE_OK) &&
+      (prefetch->truncated == FALSE));
+  value = gst_structure_get_string (prefetch->headers, "accept-ranges");
+  ranges = ((value == NULL) || (g_ascii_strncasecmp (value, "none", 4) != 0));
+  if ((prefetch->status_code != 200) || ((complete == FALSE) &&
+          ((prefetch->len == 0) || (ranges == FALSE)))) {
+    GST_INFO_OBJECT (src, "Prefetch of URI %s is no use (status %u, result "
+        "%d), fetching it again", src->uri, prefetch->status_code,
+        prefetch->result);
+    gst_curl_http_src_free_part (src, prefetch);
+    return GST_FLOW_CUSTOM_SUCCESS;
+  }
+  gst_curl_http_src_learn_headers (src, prefetch->headers);
+
+  GST_INFO_OBJECT (src, "Taking over %" G_GSIZE_FORMAT " prefetched bytes "
+      "of URI %s%s", prefetch->len, src->uri,
+      (complete == TRUE) ? "" : ", fetching the rest");
+  while ((chunk = g_queue_pop_head (&prefetch->buffers)) != NULL) {
+    g_queue_push_tail (&src->buffer_queue, chunk);
+  }
+  src->buffer_len += prefetch->len;
+  prefetch->len = 0;
+
+  if (complete == FALSE) {
+    /* If-Range makes sure the rest belongs with what we've got */
+    src->request_position = src->buffer_len;
+    gst_curl_http_src_free_part (src, prefetch);
+    return GST_FLOW_OK;
+  }
+
+  /*
+   * curl is done with the prefetch's handle, so it can stand in for ours as
+   * far as handle_response() is concerned.
+   */
+  gst_curl_http_src_take_response (src, prefetch->status_code,
+      prefetch->headers);
+  gst_curl_http_src_destroy_easy_handle (src);
+  src->curl_handle = prefetch->handle;
+  src->slist = prefetch->slist;
+  prefetch->handle = NULL;
+  prefetch->slist = NULL;
+  curl_easy_setopt (src->curl_handle, CURLOPT_ERRORBUFFER, src->curl_errbuf);
+  gst_curl_http_src_free_part (src, prefetch);
+
+  return GST_FLOW_OK;
+}
+
+/*
+ * Stand in a complete response we already have for our own transfer, so that
+ * ::create() just has to push it out. The body must already be queued up.
+ * Called with the buffer_mutex held.
+ */
+static void
+gst_curl_http_src_take_response (GstCurlHttpSrc * src, guint status_code,
+    const GstStructure * headers)
+{
+  gst_curl_http_src_drop_cache_body (src);
+  if (src->http_headers != NULL) {
+    gst_structure_free (src->http_headers);
+  }
+  src->http_headers = gst_structure_new (HTTP_HEADERS_NAME,
+      URI_NAME, G_TYPE_STRING, src->uri,
+      REQUEST_HEADERS_NAME, GST_TYPE_STRUCTURE, src->request_headers,
+      RESPONSE_HEADERS_NAME, GST_TYPE_STRUCTURE, headers,
+      HTTP_STATUS_CODE, G_TYPE_UINT, status_code, NULL);
+  src->status_code = status_code;
+  src->hdrs_updated = TRUE;
+  gst_curl_http_src_negotiate_caps (src);
+
+  src->state = GSTCURL_DONE;
+  src->curl_result = CURLE_OK;
+  src->transfer_begun = TRUE;
+  src->data_received = FALSE;
+  src->paused = FALSE;
+}
+
+/*
+ * Pick up what get_header() would have from response headers that came to us
+ * some other way. Called with the buffer_mutex held.
+ */
+static void
+gst_curl_http_src_learn_headers (GstCurlHttpSrc * src,
+    const GstStructure * headers)
+{
+  const gchar *value;
+
+  value = gst_structure_get_string (headers, "accept-ranges");
+  if (value != NULL) {
+    src->seekable = (g_ascii_strncasecmp (value, "none", 4) != 0);
+  }
+  value = gst_structure_get_string (headers, "etag");
+  if (value != NULL) {
+    g_free (src->etag);
+    src->etag = g_strstrip (g_strdup (value));
+  }
+  value = gst_structure_get_string (headers, "last-modified");
+  if (value != NULL) {
+    g_free (src->last_modified);
+    src->last_modified = g_strstrip (g_strdup (value));
+  }
+}
+
+/*
+ * Serve our URI from the caches, if it's in one of them and still fresh. A
+ * stale response from the cache directory, or failing that the last one we
+ * had ourselves, is held on to while the server is asked whether it has
+ * changed. Called with the buffer_mutex held before a
+ * new transfer starts. Returns TRUE if there's nothing left to fetch.
+ */
+static gboolean
+gst_curl_http_src_serve_cached (GstCurlHttpSrc * src)
+{
+  GstCurlHttpSrcClass *klass = G_TYPE_INSTANCE_GET_CLASS (src,
+      GST_TYPE_CURL_HTTP_SRC,
+      GstCurlHttpSrcClass);
+  GstStructure *headers = NULL;
+  GstBuffer *body = NULL;
+  gboolean fresh = TRUE;
+
+  if (((src->response_cache == FALSE) && (src->cache_directory == NULL) &&
+          (src->revalidate == FALSE)) ||
+      (src->request_position != 0) || (src->stop_position != -1) ||
+      (src->read_position != 0) || (src->buffer_len != 0)) {
+    return FALSE;
+  }
+  gst_curl_http_src_drop_stale (src);
+
+  if ((src->response_cache == TRUE) &&
+      (gst_curl_http_src_cache_lookup (klass, src->uri, src->request_headers,
+              &headers, &body) == TRUE) &&
+      (gst_curl_http_src_serve_shared (src, &headers, &body) == TRUE)) {
+    GST_INFO_OBJECT (src, "Serving %" G_GSIZE_FORMAT " bytes of URI %s from "
+        "the response cache", gst_buffer_get_size (body), src->uri);
+  } else if ((src->cache_directory != NULL) &&
+      (gst_curl_http_src_disk_cache_lookup (src->cache_directory, src->uri,
+              src->request_headers, &headers, &body, &fresh) == TRUE) &&
+      (gst_curl_http_src_serve_shared (src, &headers, &body) == TRUE) &&
+      (fresh == TRUE)) {
+    GST_INFO_OBJECT (src, "Serving %" G_GSIZE_FORMAT " bytes of URI %s from "
+        "the cache directory", gst_buffer_get_size (body), src->uri);
+  } else {
+    if ((fresh == FALSE) && (headers != NULL)) {
+      /* The disk lookup found a stale one, which might still be usable */
+      if (gst_curl_http_src_cache_revalidatable (headers) == TRUE) {
+        src->stale_headers = headers;
+        src->stale_body = body;
+      } else {
+        gst_structure_free (headers);
+        gst_buffer_unref (body);
+      }
+    }
+    if ((src->stale_body == NULL) && (src->revalidate == TRUE)) {
+      gst_curl_http_src_cache_recall (&src->validated, src->uri,
+          src->request_headers, &src->stale_headers, &src->stale_body);
+    }
+    if (src->stale_body != NULL) {
+      GST_INFO_OBJECT (src, "Revalidating earlier response for URI %s",
+          src->uri);
+    }
+    return FALSE;
+  }
+
+  gst_curl_http_src_serve_body (src, headers, body);
+  gst_structure_free (headers);
+  gst_buffer_unref (body);
+
+  return TRUE;
+}
+
+/*
+ * Stop at any extra header that carries credentials or cookies, whatever case
+ * it was given in.
+ */
+static gboolean
+_header_is_anonymous (GQuark field_id, const GValue * value, gpointer ptr)
+{
+  const gchar *name = g_quark_to_string (field_id);
+
+  return (g_ascii_strcasecmp (name, "Authorization") != 0) &&
+      (g_ascii_strcasecmp (name, "Proxy-Authorization") != 0) &&
+      (g_ascii_strcasecmp (name, "Cookie") != 0);
+}
+
+/*
+ * Whether our requests carry credentials or cookies, so that what comes back
+ * may be meant for us alone. They can come from the properties for them or
+ * from extra-headers.
+ */
+static gboolean
+gst_curl_http_src_authenticated (GstCurlHttpSrc * src)
+{
+  if ((src->username != NULL) || (src->password != NULL) ||
+      (src->proxy_user != NULL) || (src->proxy_pass != NULL) ||
+      (src->number_cookies > 0)) {
+    return TRUE;
+  }
+  return (src->request_headers != NULL) &&
+      (gst_structure_foreach (src->request_headers, _header_is_anonymous,
+          NULL) == FALSE);
+}
+
+/*
+ * Check that a response out of one of the shared caches can go to us, which
+ * it can't if it was kept for anonymous requests and ours aren't. If not, it
+ * is let go of, and headers and body set to NULL.
+ */
+static gboolean
+gst_curl_http_src_serve_shared (GstCurlHttpSrc * src, GstStructure ** headers,
+    GstBuffer ** body)
+{
+  if (gst_curl_http_src_cache_shareable (*headers,
+          gst_curl_http_src_authenticated (src)) == TRUE) {
+    return TRUE;
+  }
+
+  GST_DEBUG_OBJECT (src, "Not serving cached URI %s to an authenticated "
+      "request", src->uri);
+  gst_structure_free (*headers);
+  gst_buffer_unref (*body);
+  *headers = NULL;
+  *body = NULL;
+  return FALSE;
+}
+
+/*
+ * Queue up a complete cached response in place of our own transfer.
+ */
+static void
+gst_curl_http_src_serve_body (GstCurlHttpSrc * src,
+    const GstStructure * headers, GstBuffer * body)
+{
+  gsize offset, size;
+
+  /* The blocks share the cached memory rather than copying it */
+  size = gst_buffer_get_size (body);
+  for (offset = 0; offset < size; offset += src->block_size) {
+    g_queue_push_tail (&src->buffer_queue, gst_buffer_copy_region (body,
+            GST_BUFFER_COPY_MEMORY, offset, MIN (src->block_size,
+                size - offset)));
+  }
+  src->buffer_len = size;
+  src->content_size = size;
+  src->have_size = TRUE;
+
+  gst_curl_http_src_learn_headers (src, headers);
+  gst_curl_http_src_take_response (src, 200, headers);
+}
+
+/*
+ * The server says the stale response we asked about hasn't changed. Bring its
+ * headers up to date, keep it for as long as they now allow, and serve it as
+ * not modified. Called with the buffer_mutex held once the 304 has arrived.
+ */
+static void
+gst_curl_http_src_serve_revalidated (GstCurlHttpSrc * src)
+{
+  GstCurlHttpSrcClass *klass = G_TYPE_INSTANCE_GET_CLASS (src,
+      GST_TYPE_CURL_HTTP_SRC,
+      GstCurlHttpSrcClass);
+  GstStructure *headers = src->stale_headers;
+  GstBuffer *body = src->stale_body;
+  const GstStructure *update;
+  const gchar *name;
+  gint64 lifetime;
+  gboolean shareable;
+  gint i;
+
+  src->stale_headers = NULL;
+  src->stale_body = NULL;
+
+  /* Whatever came with the 304 replaces what we had, except for the length */
+  update = gst_value_get_structure (gst_structure_get_value
+      (src->http_headers, RESPONSE_HEADERS_NAME));
+  for (i = 0; i < gst_structure_n_fields (update); i++) {
+    name = gst_structure_nth_field_name (update, i);
+    if (g_strcmp0 (name, "content-length") != 0) {
+      gst_structure_set_value (headers, name,
+          gst_structure_get_value (update, name));
+    }
+  }
+
+  lifetime = gst_curl_http_src_cache_lifetime (headers);
+  shareable = gst_curl_http_src_cache_shareable (headers,
+      gst_curl_http_src_authenticated (src));
+  GST_INFO_OBJECT (src, "Cached response for URI %s hasn't changed, fresh "
+      "for %" G_GINT64_FORMAT "s", src->uri, lifetime);
+  if ((src->cache_directory != NULL) && (shareable == TRUE) &&
+      (gst_curl_http_src_disk_cache_refresh (src->cache_directory, src->uri,
+              src->request_headers, headers, gst_buffer_get_size (body),
+              lifetime) == FALSE)) {
+    GST_WARNING_OBJECT (src, "Couldn't write to cache directory %s",
+        src->cache_directory);
+  }
+  if ((src->response_cache == TRUE) && (shareable == TRUE)) {
+    gst_curl_http_src_cache_insert (klass, src->uri, src->request_headers,
+        headers, body, lifetime);
+  }
+  if (src->revalidate == TRUE) {
+    gst_curl_http_src_cache_remember (&src->validated,
+        GSTCURL_MAX_VALIDATED_RESPONSES, src->uri, src->request_headers,
+        headers, body);
+  }
+
+  /* curl is done with it, and handle_response() would only look at the 304 */
+  gst_curl_http_src_destroy_easy_handle (src);
+  gst_curl_http_src_serve_body (src, headers, body);
+  gst_structure_set (src->http_headers, NOT_MODIFIED_NAME, G_TYPE_BOOLEAN,
+      TRUE, NULL);
+  gst_structure_free (headers);
+  gst_buffer_unref (body);
+}
+
+/*
+ * Add a buffer that's going downstream to the copies being kept for the
+ * caches. Called with the buffer_mutex held. Returns TRUE if it also has to
+ * go into the cache directory, which is left to ::_write_cached() once the
+ * lock is let go of.
+ */
+static gboolean
+gst_curl_http_src_keep_cached (GstCurlHttpSrc * src, GstBuffer * buf)
+{
+  GstCurlHttpSrcClass *klass = G_TYPE_INSTANCE_GET_CLASS (src,
+      GST_TYPE_CURL_HTTP_SRC,
+      GstCurlHttpSrcClass);
+  GstMapInfo map;
+  gboolean kept, write = FALSE;
+
+  if (src->cache_body != NULL) {
+    kept = gst_buffer_map (buf, &map, GST_MAP_READ);
+    if (kept == TRUE) {
+      g_byte_array_append (src->cache_body, map.data, map.size);
+      gst_buffer_unmap (buf, &map);
+    }
+    if ((kept == FALSE) ||
+        (src->cache_body->len > klass->response_cache_budget)) {
+      GST_DEBUG_OBJECT (src, "Not keeping URI %s in the response cache",
+          src->uri);
+      g_byte_array_unref (src->cache_body);
+      src->cache_body = NULL;
+    }
+  }
+
+  if (src->cache_fd >= 0) {
+    src->cache_file_size += gst_buffer_get_size (buf);
+    if (src->cache_file_size > src->cache_directory_size) {
+      GST_DEBUG_OBJECT (src, "Not keeping URI %s in the cache directory",
+          src->uri);
+      gst_curl_http_src_disk_cache_abandon (src->cache_fd, src->cache_file);
+      src->cache_fd = -1;
+      g_free (src->cache_file);
+      src->cache_file = NULL;
+    } else {
+      write = TRUE;
+    }
+  }
+
+  if ((src->cache_body == NULL) && (src->cache_fd < 0)) {
+    gst_curl_http_src_drop_cache_body (src);
+  }
+  return write;
+}
+
+/*
+ * Write a buffer that ::_keep_cached() said was for the cache directory.
+ * Called from ::create() without the buffer_mutex held. The cache file is
+ * only ever started, finished or given up on from the streaming thread (or
+ * once it has stopped), so it can't go away underneath us.
+ */
+static void
+gst_curl_http_src_write_cached (GstCurlHttpSrc * src, GstBuffer * buf)
+{
+  if (gst_curl_http_src_disk_cache_write (src->cache_fd, buf) == TRUE) {
+    return;
+  }
+
+  GST_DEBUG_OBJECT (src, "Not keeping URI %s in the cache directory",
+      src->uri);
+  g_mutex_lock (&src->buffer_mutex);
+  gst_curl_http_src_disk_cache_abandon (src->cache_fd, src->cache_file);
+  src->cache_fd = -1;
+  g_free (src->cache_file);
+  src->cache_file = NULL;
+  if (src->cache_body == NULL) {
+    gst_curl_http_src_drop_cache_body (src);
+  }
+  g_mutex_unlock (&src->buffer_mutex);
+}
+
+/*
+ * Put the response that has just finished into the in-memory caches. Called
+ * with the buffer_mutex held. What's going into the cache directory is handed
+ * back, to be put in place with ::_commit_cached() once the lock is let go
+ * of, or NULL if there's nothing for it.
+ */
+static GstCurlHttpSrcDiskCommit *
+gst_curl_http_src_store_cached (GstCurlHttpSrc * src)
+{
+  GstCurlHttpSrcClass *klass = G_TYPE_INSTANCE_GET_CLASS (src,
+      GST_TYPE_CURL_HTTP_SRC,
+      GstCurlHttpSrcClass);
+  GstCurlHttpSrcDiskCommit *commit = NULL;
+  GstBuffer *body;
+  gsize size;
+
+  if ((src->cache_body != NULL) && (src->cache_body->len > 0)) {
+    size = src->cache_body->len;
+    body = gst_buffer_new_wrapped (g_byte_array_free (src->cache_body, FALSE),
+        size);
+    src->cache_body = NULL;
+    GST_DEBUG_OBJECT (src, "Caching %" G_GSIZE_FORMAT " bytes of URI %s for %"
+        G_GINT64_FORMAT "s", size, src->uri, src->cache_lifetime);
+    if ((src->response_cache == TRUE) &&
+        gst_curl_http_src_cache_shareable (src->cache_headers,
+            gst_curl_http_src_authenticated (src))) {
+      gst_curl_http_src_cache_insert (klass, src->uri, src->request_headers,
+          src->cache_headers, body, src->cache_lifetime);
+    }
+    if ((src->revalidate == TRUE) &&
+        gst_curl_http_src_cache_revalidatable (src->cache_headers)) {
+      gst_curl_http_src_cache_remember (&src->validated,
+          GSTCURL_MAX_VALIDATED_RESPONSES, src->uri, src->request_headers,
+          src->cache_headers, body);
+    }
+    gst_buffer_unref (body);
+  }
+
+  if ((src->cache_fd >= 0) && (src->cache_file_size > 0)) {
+    commit = g_new0 (GstCurlHttpSrcDiskCommit, 1);
+    commit->directory = g_strdup (src->cache_directory);
+    commit->max_size = src->cache_directory_size;
+    commit->uri = g_strdup (src->uri);
+    if (src->request_headers != NULL) {
+      commit->request_headers = gst_structure_copy (src->request_headers);
+    }
+    commit->headers = src->cache_headers;
+    commit->fd = src->cache_fd;
+    commit->file = src->cache_file;
+    commit->size = src->cache_file_size;
+    commit->lifetime = src->cache_lifetime;
+    src->cache_headers = NULL;
+    src->cache_fd = -1;
+    src->cache_file = NULL;
+  }
+  gst_curl_http_src_drop_cache_body (src);
+
+  return commit;
+}
+
+/*
+ * Put a response body that has been written out by ::_store_cached() in
+ * place in the cache directory, and free commit. Called without the
+ * buffer_mutex held, as it can take a while.
+ */
+static void
+gst_curl_http_src_commit_cached (GstCurlHttpSrc * src,
+    GstCurlHttpSrcDiskCommit * commit)
+{
+  GST_DEBUG_OBJECT (src, "Writing %" G_GUINT64_FORMAT " bytes of URI %s to "
+      "cache directory %s", commit->size, commit->uri, commit->directory);
+  if (gst_curl_http_src_disk_cache_commit (commit->directory,
+          commit->max_size, commit->uri, commit->request_headers,
+          commit->headers, commit->fd, commit->file, commit->size,
+          commit->lifetime) == FALSE) {
+    GST_WARNING_OBJECT (src, "Couldn't write to cache directory %s",
+        commit->directory);
+  }
+
+  g_free (commit->directory);
+  g_free (commit->uri);
+  if (commit->request_headers != NULL) {
+    gst_structure_free (commit->request_headers);
+  }
+  gst_structure_free (commit->headers);
+  g_free (commit->file);
+  g_free (commit);
+}
+
+/*
+ * Stop keeping a copy of the response for the caches.
+ */
+static void
+gst_curl_http_src_drop_cache_body (GstCurlHttpSrc * src)
+{
+  if (src->cache_body != NULL) {
+    g_byte_array_unref (src->cache_body);
+    src->cache_body = NULL;
+  }
+  if (src->cache_fd >= 0) {
+    gst_curl_http_src_disk_cache_abandon (src->cache_fd, src->cache_file);
+    src->cache_fd = -1;
+    g_free (src->cache_file);
+    src->cache_file = NULL;
+  }
+  if (src->cache_headers != NULL) {
+    gst_structure_free (src->cache_headers);
+    src->cache_headers = NULL;
+  }
+}
+
+/*
+ * Tell the application and downstream how the transfer that has just ended
+ * went, if it came from the server. The timing goes out as an element message
+ * of its own, and is added to the http-headers event, which goes out again.
+ * Called with the buffer_mutex held.
+ */
+static void
+gst_curl_http_src_publish_timing (GstCurlHttpSrc * src)
+{
+  GstPad *pad = GST_BASE_SRC_PAD (src);
+  GstStructure *headers = NULL;
+  const GstStructure *structure;
+  GstEvent *event;
+  guint i;
+
+  if (src->timing == NULL) {
+    return;
+  }
+
+  gst_element_post_message (GST_ELEMENT_CAST (src),
+      gst_message_new_element (GST_OBJECT_CAST (src),
+          gst_structure_copy (src->timing)));
+
+  for (i = 0; (headers == NULL) && ((event = gst_pad_get_sticky_event (pad,
+                  GST_EVENT_CUSTOM_DOWNSTREAM_STICKY, i)) != NULL); i++) {
+    structure = gst_event_get_structure (event);
+    if (gst_structure_has_name (structure, HTTP_HEADERS_NAME) &&
+        (g_strcmp0 (gst_structure_get_string (structure, URI_NAME),
+                src->uri) == 0)) {
+      headers = gst_structure_copy (structure);
+    }
+    gst_event_unref (event);
+  }
+  if (headers != NULL) {
+    gst_structure_set (headers, TRANSFER_TIMING_NAME, GST_TYPE_STRUCTURE,
+        src->timing, NULL);
+    gst_pad_push_event (pad,
+        gst_event_new_custom (GST_EVENT_CUSTOM_DOWNSTREAM_STICKY, headers));
+  }
+
+  gst_structure_free (src->timing);
+  src->timing = NULL;
+}
+
+/*
+ * Let go of a stale response we were going to revalidate.
+ */
+static void
+gst_curl_http_src_drop_stale (GstCurlHttpSrc * src)
+{
+  if (src->stale_headers != NULL) {
+    gst_structure_free (src->stale_headers);
+    src->stale_headers = NULL;
+  }
+  if (src->stale_body != NULL) {
+    gst_buffer_unref (src->stale_body);
+    src->stale_body = NULL;
+  }
+}
+
+/*
+ * Free the prefetches that are no longer wanted, once curl is done with them.
+ * Called with the buffer_mutex held.
+ */
+static void
+gst_curl_http_src_reap_prefetches (GstCurlHttpSrc * src)
+{
+  GList *link, *next;
+
+  for (link = src->prefetches.head; link != NULL; link = next) {
+    GstCurlHttpSrcPart *prefetch = link->data;
+    next = link->next;
+    if ((prefetch->cancelled == TRUE) &&
+        ((prefetch->done == TRUE) || (prefetch->queued == FALSE))) {
+      g_queue_delete_link (&src->prefetches, link);
+      gst_curl_http_src_free_part (src, prefetch);
+    }
+  }
+}
+
+/*
+ * Drop all the prefetches, getting them out of curl first. Must be called
+ * without the buffer_mutex held.
+ */
+static void
+gst_curl_http_src_cancel_prefetches (GstCurlHttpSrc * src)
+{
+  GList *link;
+  gboolean running;
+
+  g_mutex_lock (&src->buffer_mutex);
+  for (link = src->prefetches.head; link != NULL; link = link->next) {
+    GstCurlHttpSrcPart *prefetch = link->data;
+    prefetch->cancelled = TRUE;
+  }
+  running = gst_curl_http_src_parts_running (&src->prefetches);
+  g_mutex_unlock (&src->buffer_mutex);
+
+  /* A removal request takes out any prefetches that have been cancelled */
+  if (running == TRUE) {
+    gst_curl_http_src_request_remove (src);
+  }
+
+  g_mutex_lock (&src->buffer_mutex);
+  while (gst_curl_http_src_parts_running (&src->prefetches) == TRUE) {
+    g_cond_wait (&src->signal, &src->buffer_mutex);
+  }
+  gst_curl_http_src_reap_prefetches (src);
+  g_mutex_unlock (&src->buffer_mutex);
+}
+
+/*
+ * Create the easy handle for a prefetch. Apart from the URI, the request is
+ * the same as one for our own.
+ */
+static CURL *
+gst_curl_http_src_new_prefetch_handle (GstCurlHttpSrc * src,
+    GstCurlHttpSrcPart * prefetch)
+{
+  CURL *handle;
+
+  handle = gst_curl_http_src_new_easy_handle (src, 0, -1, &prefetch->slist);
+  if (handle == NULL) {
+    return NULL;
+  }
+
+  curl_easy_setopt (handle, CURLOPT_URL, prefetch->uri);
+  /* Nobody's waiting on a prefetch yet, so let it make way for those who are */
+  gst_curl_http_src_set_stream_weight (src, handle,
+      GST_CURL_HTTP_SRC_PRIORITY_LOW);
+  curl_easy_setopt (handle, CURLOPT_HEADERFUNCTION,
+      gst_curl_http_src_get_prefetch_header);
+  curl_easy_setopt (handle, CURLOPT_HEADERDATA, prefetch);
+  curl_easy_setopt (handle, CURLOPT_WRITEFUNCTION,
+      gst_curl_http_src_get_prefetch_chunks);
+  curl_easy_setopt (handle, CURLOPT_WRITEDATA, prefetch);
+  curl_easy_setopt (handle, CURLOPT_ERRORBUFFER, prefetch->errbuf);
+
+  return handle;
+}
+
+/*
+ * Which curl failures are worth trying again, because the connection dropped
+ * or stalled rather than the request being bad.
+ */
+static gboolean
+gst_curl_http_src_retryable (CURLcode result)
+{
+  switch (result) {
+    case CURLE_PARTIAL_FILE:
+    case CURLE_SEND_ERROR:
+    case CURLE_RECV_ERROR:
+    case CURLE_GOT_NOTHING:
+    case CURLE_OPERATION_TIMEDOUT:
+      return TRUE;
+    default:
+      return FALSE;
+  }
+}
+
+#ifdef CURL_VERSION_HTTP3
+/*
+ * Whether an HTTP/3 attempt failed to get going at all, in which case it's
+ * worth going round again over HTTP/2 even if the error isn't one we'd
+ * normally retry.
+ */
+static gboolean
+gst_curl_http_src_http3_fallback (GstCurlHttpSrc * src)
+{
+  if ((src->preferred_http_version != GSTCURL_HTTP_VERSION_3_0) ||
+      (src->http3_failed == TRUE) || (src->status_code != 0)) {
+    return FALSE;
+  }
+
+  switch (src->curl_result) {
+    case CURLE_COULDNT_CONNECT:
+#if LIBCURL_VERSION_NUM >= 0x074400
+    case CURLE_HTTP3:
+#endif
+#if LIBCURL_VERSION_NUM >= 0x074500
+    case CURLE_QUIC_CONNECT_ERROR:
+#endif
+      return TRUE;
+    default:
+      return FALSE;
+  }
+}
+#endif
+
+/*
+ * Drop everything we learnt about the last resource, i.e. when the URI changes.
+ */
+static void
+gst_curl_http_src_forget_resource (GstCurlHttpSrc * src)
+{
+  src->request_position = 0;
+  src->stop_position = -1;
+  src->transfer_stop = -1;
+  src->next_part_start = 0;
+  src->read_position = 0;
+  src->content_size = 0;
+  src->have_size = FALSE;
+  src->seekable = TRUE;
+  src->parallel_disabled = FALSE;
+  g_free (src->etag);
+  src->etag = NULL;
+  g_free (src->last_modified);
+  src->last_modified = NULL;
+  gst_curl_http_src_range_cache_clear (src);
+}
+
+/*
+ * Take care of any memory that may be left over from the instance that's now
+ * closing before we leak it.
+ */
+static void
+gst_curl_http_src_cleanup_instance (GstCurlHttpSrc * src)
+{
+  gint i;
+  GList *link;
+  GstCurlHttpSrcPart *prefetch;
+  GstCurlHttpSrcMultiTaskContext *context = src->context;
+
+  /* Make sure the curl loop can't come looking for us once we're gone */
+  if (context != NULL) {
+    g_mutex_lock (&context->mutex);
+    context->removal_requests =
+        g_slist_remove_all (context->removal_requests, src);
+    context->unpause_requests =
+        g_slist_remove_all (context->unpause_requests, src);
+    gst_curl_http_src_unfollow_queue_item (src);
+    if (src->queue_element != NULL) {
+      gst_curl_http_src_release_followers (src->queue_element,
+          CURLE_PARTIAL_FILE);
+    }
+    if ((src->queue_element != NULL) &&
+        (src->queue_element->queue == &context->pending_queue)) {
+      gst_curl_http_src_remove_queue_item (src);
+    }
+    for (link = src->parts.head; link != NULL; link = link->next) {
+      GstCurlHttpSrcPart *part = link->data;
+      if ((part->queue_element != NULL) &&
+          (part->queue_element->queue == &context->pending_queue)) {
+        gst_curl_http_src_remove_queue_part (part);
+      }
+    }
+    for (link = src->prefetches.head; link != NULL; link = link->next) {
+      prefetch = link->data;
+      if ((prefetch->queue_element != NULL) &&
+          (prefetch->queue_element->queue == &context->pending_queue)) {
+        gst_curl_http_src_remove_queue_part (prefetch);
+      }
+    }
+    g_mutex_unlock (&context->mutex);
+    src->context = NULL;
+  }
+
   g_mutex_lock (&src->uri_mutex);
   g_free (src->uri);
   src->uri = NULL;
@@ -1281,82 +3903,515 @@ gst_curl_http_src_cleanup_instance (GstCurlHttpSrc * src)
   g_free (src->proxy_pass);
   src->proxy_pass = NULL;
 
-  for (i = 0; i < src->number_cookies; i++) {
-    g_free (src->cookies[i]);
-    src->cookies[i] = NULL;
+  for (i = 0; i < src->number_cookies; i++) {
+    g_free (src->cookies[i]);
+    src->cookies[i] = NULL;
+  }
+  g_free (src->cookies);
+  src->cookies = NULL;
+
+  g_mutex_clear (&src->buffer_mutex);
+
+  g_cond_clear (&src->signal);
+
+  gst_curl_http_src_flush_buffer_queue (src);
+  gst_curl_http_src_free_parts (src);
+  while ((prefetch = g_queue_pop_head (&src->prefetches)) != NULL) {
+    gst_curl_http_src_free_part (src, prefetch);
+  }
+  gst_curl_http_src_drop_cache_body (src);
+  gst_curl_http_src_drop_stale (src);
+  gst_curl_http_src_cache_forget (&src->validated);
+  g_free (src->cache_directory);
+  src->cache_directory = NULL;
+  if (src->pool != NULL) {
+    gst_object_unref (src->pool);
+    src->pool = NULL;
+  }
+
+  if (src->http_headers != NULL) {
+    gst_structure_free (src->http_headers);
+    src->http_headers = NULL;
+  }
+  if (src->timing != NULL) {
+    gst_structure_free (src->timing);
+    src->timing = NULL;
+  }
+
+  gst_curl_http_src_forget_resource (src);
+
+  /*
+   * We can't be sure curl has finished with a handle that's still here, so
+   * don't risk handing it to someone else through the pool.
+   */
+  if (src->curl_handle != NULL) {
+    curl_easy_cleanup (src->curl_handle);
+    src->curl_handle = NULL;
+  }
+  gst_curl_http_src_destroy_easy_handle (src);
+}
+
+static gboolean
+gst_curl_http_src_query (GstBaseSrc * bsrc, GstQuery * query)
+{
+  GstCurlHttpSrc *src = GST_CURLHTTPSRC (bsrc);
+  gboolean ret;
+  GSTCURL_FUNCTION_ENTRY (src);
+
+  switch (GST_QUERY_TYPE (query)) {
+    case GST_QUERY_URI:
+      gst_query_set_uri (query, src->uri);
+      if (src->redirect_uri != NULL) {
+        gst_query_set_uri_redirection (query, src->redirect_uri);
+      }
+      ret = TRUE;
+      break;
+    case GST_QUERY_SCHEDULING:
+    {
+      GstSchedulingFlags flags;
+      gint minsize, maxsize, align;
+
+      /* basesrc offers pull mode too if we said we were seekable at start */
+      ret = GST_BASE_SRC_CLASS (parent_class)->query (bsrc, query);
+      if (ret == TRUE) {
+        /* Every pull might be a round trip to the server */
+        gst_query_parse_scheduling (query, &flags, &minsize, &maxsize, &align);
+        gst_query_set_scheduling (query,
+            flags | GST_SCHEDULING_FLAG_BANDWIDTH_LIMITED, minsize, maxsize,
+            align);
+      }
+    }
+      break;
+    default:
+      ret = GST_BASE_SRC_CLASS (parent_class)->query (bsrc, query);
+      break;
+  }
+
+  GSTCURL_FUNCTION_EXIT (src);
+  return ret;
+}
+
+/*
+ * Settle on a pool of fixed size receive blocks. Use the one downstream offers
+ * if there is one (a demuxer or shared memory sink might want its own memory),
+ * otherwise make our own, and limit it to pool-depth buffers either way.
+ */
+static gboolean
+gst_curl_http_src_decide_allocation (GstBaseSrc * bsrc, GstQuery * query)
+{
+  GstCurlHttpSrc *src = GST_CURLHTTPSRC (bsrc);
+  GstBufferPool *pool = NULL;
+  GstAllocator *allocator = NULL;
+  GstAllocationParams params;
+  GstStructure *config;
+  GstCaps *caps;
+  guint size, min, max;
+  gboolean update_pool;
+
+  gst_query_parse_allocation (query, &caps, NULL);
+
+  if (gst_query_get_n_allocation_params (query) > 0) {
+    gst_query_parse_nth_allocation_param (query, 0, &allocator, &params);
+  } else {
+    gst_allocation_params_init (&params);
+  }
+
+  if (gst_query_get_n_allocation_pools (query) > 0) {
+    gst_query_parse_nth_allocation_pool (query, 0, &pool, &size, &min, &max);
+    update_pool = TRUE;
+  } else {
+    size = min = max = 0;
+    update_pool = FALSE;
+  }
+
+  if (pool == NULL) {
+    GST_DEBUG_OBJECT (src, "No pool offered by downstream, making our own");
+    pool = gst_buffer_pool_new ();
+  }
+
+  if (size == 0) {
+    size = gst_base_src_get_blocksize (bsrc);
+  }
+  if ((src->pool_depth > 0) && ((max == 0) || (max > src->pool_depth))) {
+    max = src->pool_depth;
+  }
+  if ((max > 0) && (min > max)) {
+    min = max;
+  }
+
+  config = gst_buffer_pool_get_config (pool);
+  gst_buffer_pool_config_set_params (config, caps, size, min, max);
+  gst_buffer_pool_config_set_allocator (config, allocator, &params);
+  if (gst_buffer_pool_set_config (pool, config) == FALSE) {
+    /* The pool might have adjusted the values, accept what it wants instead */
+    config = gst_buffer_pool_get_config (pool);
+    if ((gst_buffer_pool_config_get_params (config, NULL, &size, &min,
+                &max) == FALSE) ||
+        (gst_buffer_pool_set_config (pool, config) == FALSE)) {
+      GST_ERROR_OBJECT (src, "Failed to configure receive buffer pool");
+      if (allocator != NULL) {
+        gst_object_unref (allocator);
+      }
+      gst_object_unref (pool);
+      return FALSE;
+    }
+  }
+  GST_INFO_OBJECT (src, "Using receive pool of %u byte blocks (min %u, max %u)",
+      size, min, max);
+
+  if (update_pool == TRUE) {
+    gst_query_set_nth_allocation_pool (query, 0, pool, size, min, max);
+  } else {
+    gst_query_add_allocation_pool (query, pool, size, min, max);
+  }
+
+  if (allocator != NULL) {
+    gst_object_unref (allocator);
+  }
+  gst_object_unref (pool);
+
+  return TRUE;
+}
+
+static gboolean
+gst_curl_http_src_get_content_length (GstBaseSrc * bsrc, guint64 * size)
+{
+  GstCurlHttpSrc *src = GST_CURLHTTPSRC (bsrc);
+  gboolean ret = FALSE;
+
+  g_mutex_lock (&src->buffer_mutex);
+  if (src->have_size == TRUE) {
+    *size = src->content_size;
+    ret = TRUE;
+  } else {
+    GST_DEBUG_OBJECT (src, "No content length has yet been set!");
+  }
+  g_mutex_unlock (&src->buffer_mutex);
+
+  return ret;
+}
+
+/*
+ * Assume we can seek until the server tells us otherwise, either with
+ * Accept-Ranges: none or by answering a range request with the whole body.
+ */
+static gboolean
+gst_curl_http_src_is_seekable (GstBaseSrc * bsrc)
+{
+  GstCurlHttpSrc *src = GST_CURLHTTPSRC (bsrc);
+  gboolean ret;
+
+  g_mutex_lock (&src->buffer_mutex);
+  ret = src->seekable;
+  g_mutex_unlock (&src->buffer_mutex);
+
+  return ret;
+}
+
+/*
+ * Move to a new byte position. Any transfer that is already running is taken
+ * off curl, and the next call to ::create() starts a new one with a Range
+ * header covering the segment. The streaming thread isn't running here.
+ */
+static gboolean
+gst_curl_http_src_do_seek (GstBaseSrc * bsrc, GstSegment * segment)
+{
+  GstCurlHttpSrc *src = GST_CURLHTTPSRC (bsrc);
+
+  GSTCURL_FUNCTION_ENTRY (src);
+
+  if ((segment->format != GST_FORMAT_BYTES) || (segment->rate < 0.0)) {
+    GST_WARNING_OBJECT (src, "Can only seek forwards in bytes");
+    return FALSE;
   }
-  g_free (src->cookies);
-  src->cookies = NULL;
 
-  g_mutex_clear (&src->buffer_mutex);
+  g_mutex_lock (&src->buffer_mutex);
+  GST_DEBUG_OBJECT (src, "Seek to %" G_GUINT64_FORMAT "-%" G_GINT64_FORMAT
+      " (currently at %" G_GUINT64_FORMAT ")", segment->start,
+      (gint64) segment->stop, src->read_position);
+
+  if ((src->read_position == segment->start) &&
+      (src->stop_position == segment->stop)) {
+    /* Either we haven't started yet, or we're already going there */
+    g_mutex_unlock (&src->buffer_mutex);
+    return TRUE;
+  }
+  if (src->seekable == FALSE) {
+    GST_WARNING_OBJECT (src, "Server doesn't support seeking");
+    g_mutex_unlock (&src->buffer_mutex);
+    return FALSE;
+  }
+  if ((src->have_size == TRUE) && (segment->start >= src->content_size)) {
+    GST_WARNING_OBJECT (src, "Seek to %" G_GUINT64_FORMAT " is past the end "
+        "(%" G_GUINT64_FORMAT " bytes)", segment->start, src->content_size);
+    g_mutex_unlock (&src->buffer_mutex);
+    return FALSE;
+  }
+  g_mutex_unlock (&src->buffer_mutex);
 
-  g_cond_clear (&src->signal);
+  gst_curl_http_src_abort_transfer (src);
 
-  g_free (src->buffer);
-  src->buffer = NULL;
+  g_mutex_lock (&src->buffer_mutex);
+  src->request_position = segment->start;
+  src->read_position = segment->start;
+  src->stop_position = segment->stop;
+  g_mutex_unlock (&src->buffer_mutex);
 
-  if (src->http_headers != NULL) {
-    gst_structure_free (src->http_headers);
-    src->http_headers = NULL;
+  GSTCURL_FUNCTION_EXIT (src);
+  return TRUE;
+}
+
+/*
+ * Take any transfer we've started off curl, waiting for it to go if it's still
+ * running, and throw away whatever it left behind. Must be called without the
+ * buffer_mutex held, and while ::create() isn't running.
+ */
+static void
+gst_curl_http_src_abort_transfer (GstCurlHttpSrc * src)
+{
+  gboolean running;
+
+  g_mutex_lock (&src->buffer_mutex);
+  running = src->transfer_begun;
+  g_mutex_unlock (&src->buffer_mutex);
+
+  if (running == FALSE) {
+    return;
   }
 
+  /* Get the old transfer out of curl before its handle gets reused */
+  gst_curl_http_src_request_remove (src);
+
+  g_mutex_lock (&src->buffer_mutex);
+  while ((src->state == GSTCURL_OK) ||
+      (gst_curl_http_src_parts_running (&src->parts) == TRUE)) {
+    g_cond_wait (&src->signal, &src->buffer_mutex);
+  }
+  gst_curl_http_src_flush_buffer_queue (src);
+  gst_curl_http_src_free_parts (src);
+  gst_curl_http_src_drop_cache_body (src);
+  gst_curl_http_src_drop_stale (src);
+  if (src->timing != NULL) {
+    gst_structure_free (src->timing);
+    src->timing = NULL;
+  }
+  src->transfer_stop = -1;
+  src->paused = FALSE;
+  src->state = GSTCURL_NONE;
+  src->transfer_begun = FALSE;
+  src->status_code = 0;
+  src->hdrs_updated = FALSE;
   gst_curl_http_src_destroy_easy_handle (src);
+  g_mutex_unlock (&src->buffer_mutex);
 }
 
-static gboolean
-gst_curl_http_src_query (GstBaseSrc * bsrc, GstQuery * query)
+/*
+ * GstBaseSrc::create. In push mode this just goes on to ::create() above,
+ * which carries on from wherever the last buffer ended. In pull mode, put the
+ * requested range together from the block cache, fetching what's missing.
+ */
+static GstFlowReturn
+gst_curl_http_src_create_range (GstBaseSrc * bsrc, guint64 offset,
+    guint length, GstBuffer ** outbuf)
 {
   GstCurlHttpSrc *src = GST_CURLHTTPSRC (bsrc);
-  gboolean ret;
-  GSTCURL_FUNCTION_ENTRY (src);
+  GstBuffer *out = NULL;
+  GstBuffer *block, *data, *region;
+  GstFlowReturn ret = GST_FLOW_OK;
+  guint64 pos, end, block_start, run_end, size, o;
+  gsize block_len, take;
 
-  switch (GST_QUERY_TYPE (query)) {
-    case GST_QUERY_URI:
-      gst_query_set_uri (query, src->uri);
-      if (src->redirect_uri != NULL) {
-        gst_query_set_uri_redirection (query, src->redirect_uri);
+  if (GST_PAD_MODE (GST_BASE_SRC_PAD (bsrc)) != GST_PAD_MODE_PULL) {
+    return GST_BASE_SRC_CLASS (parent_class)->create (bsrc, offset, length,
+        outbuf);
+  }
+
+  GST_LOG_OBJECT (src, "Pulling %u bytes at offset %" G_GUINT64_FORMAT,
+      length, offset);
+
+  end = offset + length;
+  g_mutex_lock (&src->buffer_mutex);
+  if (src->have_size == TRUE) {
+    if (offset >= src->content_size) {
+      g_mutex_unlock (&src->buffer_mutex);
+      return GST_FLOW_EOS;
+    }
+    end = MIN (end, src->content_size);
+  }
+  g_mutex_unlock (&src->buffer_mutex);
+
+  pos = offset;
+  while (pos < end) {
+    block_start = pos - (pos % GSTCURL_RANGE_BLOCK_SIZE);
+    block = gst_curl_http_src_range_cache_lookup (src, block_start);
+
+    if (block == NULL) {
+      /*
+       * Get this block, and as many of the missing ones after it as the read
+       * needs, in one request. Keep it small enough that the cache can hold
+       * it all, or we'd be evicting blocks we're about to use.
+       */
+      run_end = block_start + GSTCURL_RANGE_BLOCK_SIZE;
+      while ((run_end < end) && (run_end - block_start <
+              (GSTCURL_RANGE_CACHE_BLOCKS / 2) * GSTCURL_RANGE_BLOCK_SIZE)) {
+        GstBuffer *cached = gst_curl_http_src_range_cache_lookup (src,
+            run_end);
+        if (cached != NULL) {
+          gst_buffer_unref (cached);
+          break;
+        }
+        run_end += GSTCURL_RANGE_BLOCK_SIZE;
       }
-      ret = TRUE;
+
+      ret = gst_curl_http_src_fetch_range (src, block_start, run_end, &data);
+      if (ret != GST_FLOW_OK) {
+        break;
+      }
+
+      size = gst_buffer_get_size (data);
+      for (o = 0; o < size; o += GSTCURL_RANGE_BLOCK_SIZE) {
+        region = gst_buffer_copy_region (data, GST_BUFFER_COPY_ALL, o,
+            MIN (GSTCURL_RANGE_BLOCK_SIZE, size - o));
+        GST_BUFFER_OFFSET (region) = block_start + o;
+        if (o == 0) {
+          block = gst_buffer_ref (region);
+        }
+        gst_curl_http_src_range_cache_insert (src, region);
+      }
+      gst_buffer_unref (data);
+
+      if (block == NULL) {
+        /* Nothing there, we've run off the end */
+        ret = GST_FLOW_EOS;
+        break;
+      }
+    }
+
+    block_len = gst_buffer_get_size (block);
+    if (pos >= block_start + block_len) {
+      gst_buffer_unref (block);
+      ret = GST_FLOW_EOS;
       break;
-    default:
-      ret = GST_BASE_SRC_CLASS (parent_class)->query (bsrc, query);
+    }
+    take = MIN (block_start + block_len, end) - pos;
+    region = gst_buffer_copy_region (block, GST_BUFFER_COPY_ALL,
+        pos - block_start, take);
+    gst_buffer_unref (block);
+    out = (out == NULL) ? region : gst_buffer_append (out, region);
+    pos += take;
+
+    if (block_len < GSTCURL_RANGE_BLOCK_SIZE) {
+      /* A short block is the last one */
       break;
+    }
   }
 
-  GSTCURL_FUNCTION_EXIT (src);
-  return ret;
+  if (out == NULL) {
+    return (ret == GST_FLOW_OK) ? GST_FLOW_EOS : ret;
+  }
+  if ((ret != GST_FLOW_OK) && (ret != GST_FLOW_EOS)) {
+    gst_buffer_unref (out);
+    return ret;
+  }
+
+  GST_BUFFER_OFFSET (out) = offset;
+  GST_BUFFER_OFFSET_END (out) = offset + gst_buffer_get_size (out);
+  *outbuf = out;
+
+  return GST_FLOW_OK;
 }
 
-static gboolean
-gst_curl_http_src_get_content_length (GstBaseSrc * bsrc, guint64 * size)
+/*
+ * Fetch the bytes from start up to (not including) stop as one buffer. This
+ * runs a transfer limited to the range through ::create(), so it's retried
+ * and resumed exactly as a push mode transfer would be.
+ */
+static GstFlowReturn
+gst_curl_http_src_fetch_range (GstCurlHttpSrc * src, guint64 start,
+    guint64 stop, GstBuffer ** outbuf)
 {
-  GstCurlHttpSrc *src = GST_CURLHTTPSRC (bsrc);
-  const GValue *response_headers;
-  gboolean ret = FALSE;
+  GstBuffer *data = NULL;
+  GstBuffer *chunk;
+  GstFlowReturn ret;
 
-  if (src->http_headers == NULL) {
-    return FALSE;
+  GST_DEBUG_OBJECT (src, "Fetching range %" G_GUINT64_FORMAT "-%"
+      G_GUINT64_FORMAT, start, stop - 1);
+
+  /* Anything left over from the last one was cut short */
+  gst_curl_http_src_abort_transfer (src);
+
+  g_mutex_lock (&src->buffer_mutex);
+  src->request_position = start;
+  src->read_position = start;
+  src->stop_position = stop;
+  g_mutex_unlock (&src->buffer_mutex);
+
+  while ((ret = gst_curl_http_src_create (GST_PUSH_SRC (src), &chunk))
+      == GST_FLOW_OK) {
+    data = (data == NULL) ? chunk : gst_buffer_append (data, chunk);
+    if (gst_buffer_get_size (data) > stop - start) {
+      /* The server ignored the range, so don't wait for the whole thing */
+      gst_curl_http_src_abort_transfer (src);
+      gst_buffer_resize (data, 0, stop - start);
+      break;
+    }
   }
 
-  response_headers = gst_structure_get_value (src->http_headers,
-      RESPONSE_HEADERS_NAME);
-  if (gst_structure_has_field (gst_value_get_structure (response_headers),
-          "content-length") == TRUE) {
-    const GValue *content_length =
-        gst_structure_get_value (gst_value_get_structure (response_headers),
-        "content-length");
-    if (G_VALUE_HOLDS_STRING (content_length) == TRUE) {
-      const gchar *len = g_value_get_string (content_length);
-      *size = (guint64) g_ascii_strtoull (len, NULL, 10);
-      ret = TRUE;
-    } else {
-      GST_ERROR_OBJECT (src, "Content Length doesn't contain expected string");
+  if ((ret != GST_FLOW_OK) && (ret != GST_FLOW_EOS)) {
+    if (data != NULL) {
+      gst_buffer_unref (data);
     }
+    return ret;
+  }
+  if (data == NULL) {
+    return GST_FLOW_EOS;
   }
 
-  GST_DEBUG_OBJECT (src,
-      "No content length has yet been set, or there was an error!");
-  return ret;
+  *outbuf = data;
+  return GST_FLOW_OK;
+}
+
+/*
+ * Find the cached block starting at start and move it to the front. Returns a
+ * new reference, or NULL if it isn't cached.
+ */
+static GstBuffer *
+gst_curl_http_src_range_cache_lookup (GstCurlHttpSrc * src, guint64 start)
+{
+  GList *link;
+
+  for (link = src->range_cache.head; link != NULL; link = link->next) {
+    if (GST_BUFFER_OFFSET (link->data) == start) {
+      g_queue_unlink (&src->range_cache, link);
+      g_queue_push_head_link (&src->range_cache, link);
+      return gst_buffer_ref (link->data);
+    }
+  }
+
+  return NULL;
+}
+
+/*
+ * Add a block to the front of the cache, taking ownership of it, and drop the
+ * least recently used ones if that makes it too big.
+ */
+static void
+gst_curl_http_src_range_cache_insert (GstCurlHttpSrc * src, GstBuffer * block)
+{
+  g_queue_push_head (&src->range_cache, block);
+  while (g_queue_get_length (&src->range_cache) > GSTCURL_RANGE_CACHE_BLOCKS) {
+    gst_buffer_unref (g_queue_pop_tail (&src->range_cache));
+  }
+}
+
+static void
+gst_curl_http_src_range_cache_clear (GstCurlHttpSrc * src)
+{
+  GstBuffer *block;
+
+  while ((block = g_queue_pop_head (&src->range_cache)) != NULL) {
+    gst_buffer_unref (block);
+  }
 }
 
 static void
@@ -1426,6 +4481,7 @@ gst_curl_http_src_urihandler_set_uri (GstURIHandler * handler,
     return FALSE;
   }
   source->retries_remaining = source->total_retries;
+  gst_curl_http_src_forget_resource (source);
 
   g_mutex_unlock (&source->uri_mutex);
 
@@ -1441,19 +4497,23 @@ static gboolean
 gst_curl_http_src_unlock (GstBaseSrc * bsrc)
 {
   GstCurlHttpSrc *src = GST_CURLHTTPSRC (bsrc);
+  gboolean remove = FALSE;
 
   g_mutex_lock (&src->buffer_mutex);
   if (src->state != GSTCURL_UNLOCK) {
-    if (src->state == GSTCURL_OK) {
-      /* A transfer is running, cancel it */
-      gst_curl_http_src_request_remove (src);
-    }
+    /* A transfer is running, cancel it */
+    remove = (src->state == GSTCURL_OK);
     src->pending_state = src->state;
     src->state = GSTCURL_UNLOCK;
   }
   g_cond_signal (&src->signal);
   g_mutex_unlock (&src->buffer_mutex);
 
+  /* The curl loop takes the context mutex before our buffer_mutex */
+  if (remove == TRUE) {
+    gst_curl_http_src_request_remove (src);
+  }
+
   return TRUE;
 }
 
@@ -1479,13 +4539,36 @@ gst_curl_http_src_unlock_stop (GstBaseSrc * bsrc)
 /*****************************************************************************
  * Curl loop task functions begin
  *****************************************************************************/
+/*
+ * Tell the multi loop that something has changed. As well as signalling the
+ * condition it sleeps on when idle, this kicks it out of waiting on curl's
+ * sockets, so new requests don't have to wait for network activity or a
+ * timeout before they get started. Called with the context mutex held.
+ */
+static void
+gst_curl_http_src_multi_wakeup (GstCurlHttpSrcMultiTaskContext * context)
+{
+#if defined(GSTCURL_HAVE_EPOLL)
+  guint64 one = 1;
+
+  if (write (context->wakeup_fd, &one, sizeof (one)) < 0) {
+    /* Counter is saturated, so the loop has a wakeup pending anyway */
+  }
+#elif defined(GSTCURL_HAVE_MULTI_POLL)
+  if (context->multi_handle != NULL) {
+    curl_multi_wakeup (context->multi_handle);
+  }
+#endif
+  g_cond_signal (&context->signal);
+}
+
 static void
 gst_curl_http_src_curl_multi_loop (gpointer thread_data)
 {
   GstCurlHttpSrcMultiTaskContext *context;
   GstCurlHttpSrcQueueElement *qelement;
-  int i, still_running;
-  gboolean cond = FALSE;
+  int i;
+  guint priority;
   CURLMsg *curl_message;
 
   context = (GstCurlHttpSrcMultiTaskContext *) thread_data;
@@ -1503,47 +4586,136 @@ gst_curl_http_src_curl_multi_loop (gpointer thread_data)
 
   if (context->state == GSTCURL_MULTI_LOOP_STATE_QUEUE_EVENT) {
     GSTCURL_DEBUG_PRINT ("Received a new item on the queue!");
-    if (context->queue == NULL) {
-      GSTCURL_ERROR_PRINT ("Request Queue was empty on a Queue Event!");
-      context->state = GSTCURL_MULTI_LOOP_STATE_WAIT;
-      return;
+    if (context->pending_queue.head == NULL) {
+      GSTCURL_WARNING_PRINT ("All curl handles already added for QUEUE_EVENT!");
+    }
+
+    if (context->limits_changed == TRUE) {
+      gst_curl_http_src_apply_limits (context);
     }
 
     /*
-     * Use the running mutex to lock access to each element, as the
-     * mutex's memory barriers stop cache optimisations from meaning
-     * flag values can't be trusted. The trylock will only let us in
-     * once and should fail immediately prior.
+     * Everything on the pending queue is waiting to be added to the multi
+     * handle, and nothing else is, so there's no need to look any further.
+     * The most urgent go first, and anything whose priority already has as
+     * many running as it allows waits for one of them to finish.
      */
-    qelement = context->queue;
-    while (qelement != NULL) {
-      if (g_mutex_trylock (&qelement->running) == TRUE) {
-        GSTCURL_DEBUG_PRINT ("Adding easy handle for URI %s", qelement->p->uri);
-        cond = TRUE;
-        curl_multi_add_handle (context->multi_handle, qelement->p->curl_handle);
+    for (priority = GST_CURL_HTTP_SRC_PRIORITY_HIGH;
+        priority < GSTCURL_PRIORITY_CLASSES; priority++) {
+      GstCurlHttpSrcQueueElement *next;
+
+      for (qelement = context->pending_queue.head; qelement != NULL;
+          qelement = next) {
+        next = qelement->next;
+        if ((qelement->priority != priority) ||
+            (gst_curl_http_src_queue_has_room (&context->queue,
+                    qelement) == FALSE)) {
+          continue;
+        }
+        GSTCURL_DEBUG_PRINT ("Adding easy handle for URI %s",
+            qelement->p->uri);
+        gst_curl_http_src_move_queue_item (&context->queue, qelement);
+        curl_multi_add_handle (context->multi_handle, qelement->handle);
       }
-      qelement = qelement->next;
     }
 
-    if (cond != TRUE) {
-      GSTCURL_WARNING_PRINT ("All curl handles already added for QUEUE_EVENT!");
+    /* Don't lose any removal requests that came in over the top of us */
+    if (context->removal_requests != NULL) {
+      context->state = GSTCURL_MULTI_LOOP_STATE_REQUEST_REMOVAL;
     } else {
-      GSTCURL_DEBUG_PRINT ("Finished adding all handles, continuing.");
       context->state = GSTCURL_MULTI_LOOP_STATE_RUNNING;
     }
     g_mutex_unlock (&context->mutex);
   } else if (context->state == GSTCURL_MULTI_LOOP_STATE_RUNNING) {
+    GSList *unpause = NULL;
+    gboolean throttling = FALSE;
+    GList *throttled;
+#if !defined(GSTCURL_HAVE_EPOLL) && !defined(GSTCURL_HAVE_MULTI_POLL)
     struct timeval timeout;
     gint rc;
     fd_set fdread, fdwrite, fdexcep;
     int maxfd = -1;
     long curl_timeo = -1;
+#endif
+
+    /*
+     * Resume any paused transfers whose owners have drained their buffers.
+     * Only handles still on the queue are touched, as anything else has
+     * already finished or been removed since the request was made.
+     */
+    while (context->unpause_requests != NULL) {
+      GstCurlHttpSrc *unpause_src = context->unpause_requests->data;
+      context->unpause_requests = g_slist_delete_link (
+          context->unpause_requests, context->unpause_requests);
+      qelement = unpause_src->queue_element;
+      if ((qelement != NULL) && (qelement->queue == &context->queue)) {
+        GSTCURL_DEBUG_PRINT ("Unpausing transfer for URI %s",
+            unpause_src->uri);
+        unpause = g_slist_prepend (unpause, qelement->handle);
+      }
+    }
+
+    /*
+     * Carry on with throttled transfers that there's bandwidth for again. If
+     * any are still waiting, don't wait on curl for long, as nothing will
+     * come along to wake us when there is.
+     */
+    throttled = context->queue.throttled.head;
+    while (throttled != NULL) {
+      GstCurlHttpSrc *owner;
+      GstCurlHttpSrcPart *part;
+      GstCurlHttpSrcBucket **host_bucket;
+      const gchar *uri;
+      gboolean allowed;
+
+      qelement = throttled->data;
+      throttled = throttled->next;
+      owner = qelement->p;
+      part = qelement->part;
+      host_bucket = &owner->host_bucket;
+      uri = owner->uri;
+      if ((part != NULL) && (part->uri != NULL)) {
+        /* A prefetch, which is of some other URI */
+        host_bucket = &part->host_bucket;
+        uri = part->uri;
+      }
+
+      g_mutex_lock (&owner->buffer_mutex);
+      allowed = gst_curl_http_src_shape (owner, qelement->priority, uri,
+          host_bucket, 0);
+      g_mutex_unlock (&owner->buffer_mutex);
+      if (allowed == TRUE) {
+        gst_curl_http_src_unthrottle_queue_item (qelement);
+        unpause = g_slist_prepend (unpause, qelement->handle);
+      } else {
+        throttling = TRUE;
+      }
+    }
 
     /* Because curl can possibly take some time here, be nice and let go of the
      * mutex so other threads can perform state/queue operations as we don't
      * care about those until the end of this. */
     g_mutex_unlock (&context->mutex);
 
+    /*
+     * Unpausing can hand over the held back data there and then, and passing
+     * it on to followers needs the mutex. Only this thread takes handles off
+     * the queue, so they're all still there.
+     */
+    while (unpause != NULL) {
+      curl_easy_pause (unpause->data, CURLPAUSE_CONT);
+      unpause = g_slist_delete_link (unpause, unpause);
+    }
+
+#if defined(GSTCURL_HAVE_EPOLL)
+    gst_curl_http_src_multi_socket_wait (context,
+        (throttling == TRUE) ? GSTCURL_SHAPING_INTERVAL_MS : -1);
+#elif defined(GSTCURL_HAVE_MULTI_POLL)
+    /* curl_multi_wakeup() breaks us out of this as soon as there's news */
+    curl_multi_poll (context->multi_handle, NULL, 0,
+        (throttling == TRUE) ? GSTCURL_SHAPING_INTERVAL_MS : 1000, NULL);
+    curl_multi_perform (context->multi_handle, &context->running_handles);
+#else
     FD_ZERO (&fdread);
     FD_ZERO (&fdwrite);
     FD_ZERO (&fdexcep);
@@ -1552,6 +4724,10 @@ gst_curl_http_src_curl_multi_loop (gpointer thread_data)
     timeout.tv_usec = 0;
 
     curl_multi_timeout (context->multi_handle, &curl_timeo);
+    if ((throttling == TRUE) &&
+        ((curl_timeo < 0) || (curl_timeo > GSTCURL_SHAPING_INTERVAL_MS))) {
+      curl_timeo = GSTCURL_SHAPING_INTERVAL_MS;
+    }
     if (curl_timeo >= 0) {
       timeout.tv_sec = curl_timeo / 1000;
       if (timeout.tv_sec > 1) {
@@ -1574,36 +4750,39 @@ gst_curl_http_src_curl_multi_loop (gpointer thread_data)
       case 0:
       default:
         /* timeout or readable/writable sockets */
-        curl_multi_perform (context->multi_handle, &still_running);
+        curl_multi_perform (context->multi_handle, &context->running_handles);
         break;
     }
+#endif
 
     /*
      * Check the CURL message buffer to find out if any transfers have
      * completed. If they have, call the signal_finished function which
      * will signal the g_cond_wait call in that calling instance.
      */
-    i = 0;
-    while (cond != TRUE) {
-      curl_message = curl_multi_info_read (context->multi_handle, &i);
-      if (curl_message == NULL) {
-        cond = TRUE;
-      } else if (curl_message->msg == CURLMSG_DONE) {
-        /* A hack, but I have seen curl_message->easy_handle being
-         * NULL randomly, so check for that. */
-        g_mutex_lock (&context->mutex);
-        if (curl_message->easy_handle == NULL) {
-          break;
-        }
-        curl_multi_remove_handle (context->multi_handle,
-            curl_message->easy_handle);
-        gst_curl_http_src_remove_queue_handle (&context->queue,
-            curl_message->easy_handle, curl_message->data.result);
-        g_mutex_unlock (&context->mutex);
+    while ((curl_message = curl_multi_info_read (context->multi_handle,
+                &i)) != NULL) {
+      /* A hack, but I have seen curl_message->easy_handle being
+       * NULL randomly, so check for that. */
+      if ((curl_message->msg != CURLMSG_DONE) ||
+          (curl_message->easy_handle == NULL)) {
+        continue;
+      }
+      g_mutex_lock (&context->mutex);
+      curl_multi_remove_handle (context->multi_handle,
+          curl_message->easy_handle);
+      gst_curl_http_src_collect_timing (curl_message->easy_handle);
+      gst_curl_http_src_remove_queue_handle (curl_message->easy_handle,
+          curl_message->data.result);
+      /* That might have made room for something that's waiting */
+      if ((context->pending_queue.head != NULL) &&
+          (context->state == GSTCURL_MULTI_LOOP_STATE_RUNNING)) {
+        context->state = GSTCURL_MULTI_LOOP_STATE_QUEUE_EVENT;
       }
+      g_mutex_unlock (&context->mutex);
     }
 
-    if (still_running == 0) {
+    if (context->running_handles == 0) {
       /* We've finished processing, so set the state to wait.
        *
        * This is a little more complex, as we need to catch the edge
@@ -1611,8 +4790,9 @@ gst_curl_http_src_curl_multi_loop (gpointer thread_data)
        * working.
        */
       g_mutex_lock (&context->mutex);
-      if ((context->state != GSTCURL_MULTI_LOOP_STATE_QUEUE_EVENT) &&
-          (context->state != GSTCURL_MULTI_LOOP_STATE_REQUEST_REMOVAL)) {
+      if ((context->state == GSTCURL_MULTI_LOOP_STATE_RUNNING) &&
+          (context->pending_queue.head == NULL) &&
+          (context->removal_requests == NULL)) {
         context->state = GSTCURL_MULTI_LOOP_STATE_WAIT;
       }
       g_mutex_unlock (&context->mutex);
@@ -1627,37 +4807,271 @@ gst_curl_http_src_curl_multi_loop (gpointer thread_data)
     /*gst_curl_http_src_unref_multi (NULL, GSTCURL_RETURN_PIPELINE_NULL, TRUE); */
     GSTCURL_INFO_PRINT ("Got instruction to shut down");
   } else if (context->state == GSTCURL_MULTI_LOOP_STATE_REQUEST_REMOVAL) {
-    qelement = context->queue;
-    while (qelement != NULL) {
-      if (qelement->p == context->request_removal_element) {
-        g_mutex_lock (&qelement->p->buffer_mutex);
-        curl_multi_remove_handle (context->multi_handle,
-            context->request_removal_element->curl_handle);
-        if (qelement->p->state == GSTCURL_UNLOCK) {
-          qelement->p->pending_state = GSTCURL_REMOVED;
+    while (context->removal_requests != NULL) {
+      GstCurlHttpSrc *removal_src = context->removal_requests->data;
+      gboolean unfollowed = (removal_src->following != NULL);
+      GList *link;
+      context->removal_requests = g_slist_delete_link (
+          context->removal_requests, context->removal_requests);
+
+      /*
+       * A follower just stops following. Anyone following us has to carry on
+       * by themselves from wherever they've got to.
+       */
+      gst_curl_http_src_unfollow_queue_item (removal_src);
+      if (removal_src->queue_element != NULL) {
+        gst_curl_http_src_release_followers (removal_src->queue_element,
+            CURLE_PARTIAL_FILE);
+      }
+      g_mutex_lock (&removal_src->buffer_mutex);
+
+      /* Parts of a parallel download go too, whether curl has them yet or not */
+      for (link = removal_src->parts.head; link != NULL; link = link->next) {
+        GstCurlHttpSrcPart *part = link->data;
+        if (part->done == FALSE) {
+          gst_curl_http_src_abort_part (context, part);
+        }
+      }
+
+      /* Prefetches carry on through, unless they're no longer wanted */
+      for (link = removal_src->prefetches.head; link != NULL;
+          link = link->next) {
+        GstCurlHttpSrcPart *prefetch = link->data;
+        if ((prefetch->cancelled == TRUE) && (prefetch->done == FALSE)) {
+          gst_curl_http_src_abort_part (context, prefetch);
+        }
+      }
+
+      qelement = removal_src->queue_element;
+      if ((qelement != NULL) || (unfollowed == TRUE)) {
+        if ((qelement != NULL) && (qelement->queue == &context->queue)) {
+          curl_multi_remove_handle (context->multi_handle,
+              removal_src->curl_handle);
+        }
+        if (removal_src->state == GSTCURL_UNLOCK) {
+          removal_src->pending_state = GSTCURL_REMOVED;
         } else {
-          qelement->p->state = GSTCURL_REMOVED;
+          removal_src->state = GSTCURL_REMOVED;
         }
-        g_cond_signal (&qelement->p->signal);
-        gst_curl_http_src_remove_queue_item (&context->queue, qelement->p);
-        g_mutex_unlock (&qelement->p->buffer_mutex);
+        gst_curl_http_src_remove_queue_item (removal_src);
+      }
+      g_cond_signal (&removal_src->signal);
+      g_mutex_unlock (&removal_src->buffer_mutex);
+    }
+    /* Don't lose any new requests that came in over the top of us */
+    if (context->pending_queue.head != NULL) {
+      context->state = GSTCURL_MULTI_LOOP_STATE_QUEUE_EVENT;
+    } else {
+      context->state = GSTCURL_MULTI_LOOP_STATE_RUNNING;
+    }
+    g_mutex_unlock (&context->mutex);
+  } else {
+    GSTCURL_WARNING_PRINT ("Curl Loop State was invalid or unsupported");
+    GSTCURL_WARNING_PRINT ("Signal State is %d, resetting to RUNNING.",
+        context->state);
+    /* Reset to running, so if there isn't anything to do it'll be
+     * changed the WAIT once curl_multi_perform says it has no active
+     * handles. */
+    context->state = GSTCURL_MULTI_LOOP_STATE_RUNNING;
+    g_mutex_unlock (&context->mutex);
+  }
+}
+
+/*
+ * Take a part or prefetch away from curl, whether it has started on it or not.
+ * Called from the curl loop, with the context mutex and the owner's
+ * buffer_mutex held.
+ */
+static void
+gst_curl_http_src_abort_part (GstCurlHttpSrcMultiTaskContext * context,
+    GstCurlHttpSrcPart * part)
+{
+  if ((part->queue_element != NULL) &&
+      (part->queue_element->queue == &context->queue)) {
+    curl_multi_remove_handle (context->multi_handle, part->handle);
+  }
+  gst_curl_http_src_remove_queue_part (part);
+  part->done = TRUE;
+  part->result = CURLE_ABORTED_BY_CALLBACK;
+}
+
+/*
+ * Note down how long each stage of an element's own transfer took, now that
+ * curl has finished with it, for ::create() to publish once the body has all
+ * gone downstream. Called from the curl loop with the context mutex held.
+ */
+static void
+gst_curl_http_src_collect_timing (CURL * handle)
+{
+  GstCurlHttpSrcQueueElement *qelement = NULL;
+  GstCurlHttpSrc *s;
+  GstStructure *timing;
+  gdouble dns = 0, connect = 0, tls = 0, first_byte = 0, total = 0;
+  gdouble bytes = 0, speed = 0;
+  glong connects = 0;
+
+  if ((curl_easy_getinfo (handle, CURLINFO_PRIVATE,
+              (char **) &qelement) != CURLE_OK) || (qelement == NULL) ||
+      (qelement->part != NULL)) {
+    return;
+  }
+  s = qelement->p;
+
+  /* Times are all from the start of the transfer, in seconds */
+  curl_easy_getinfo (handle, CURLINFO_NAMELOOKUP_TIME, &dns);
+  curl_easy_getinfo (handle, CURLINFO_CONNECT_TIME, &connect);
+  curl_easy_getinfo (handle, CURLINFO_APPCONNECT_TIME, &tls);
+  curl_easy_getinfo (handle, CURLINFO_STARTTRANSFER_TIME, &first_byte);
+  curl_easy_getinfo (handle, CURLINFO_TOTAL_TIME, &total);
+  curl_easy_getinfo (handle, CURLINFO_SIZE_DOWNLOAD, &bytes);
+  curl_easy_getinfo (handle, CURLINFO_SPEED_DOWNLOAD, &speed);
+  /* No new connections means it went over one that was already open */
+  curl_easy_getinfo (handle, CURLINFO_NUM_CONNECTS, &connects);
+
+  timing = gst_structure_new (TRANSFER_TIMING_NAME,
+      URI_NAME, G_TYPE_STRING, s->uri,
+      TIMING_DNS, G_TYPE_DOUBLE, dns,
+      TIMING_CONNECT, G_TYPE_DOUBLE, connect,
+      TIMING_TLS, G_TYPE_DOUBLE, tls,
+      TIMING_FIRST_BYTE, G_TYPE_DOUBLE, first_byte,
+      TIMING_TOTAL, G_TYPE_DOUBLE, total,
+      TIMING_BYTES, G_TYPE_UINT64, (guint64) bytes,
+      TIMING_SPEED, G_TYPE_DOUBLE, speed,
+      TIMING_REUSED, G_TYPE_BOOLEAN, (connects == 0), NULL);
+
+  g_mutex_lock (&s->buffer_mutex);
+  if (s->timing != NULL) {
+    gst_structure_free (s->timing);
+  }
+  s->timing = timing;
+  g_mutex_unlock (&s->buffer_mutex);
+}
+
+#ifdef GSTCURL_HAVE_EPOLL
+/*
+ * Called by curl whenever it wants us to change what we watch a socket for.
+ * The socketp pointer is only non-NULL for sockets already in the epoll set.
+ */
+static int
+gst_curl_http_src_multi_socket_cb (CURL * easy, curl_socket_t s, int what,
+    void *userp, void *socketp)
+{
+  GstCurlHttpSrcMultiTaskContext *context = userp;
+  struct epoll_event ev;
+
+  if (what == CURL_POLL_REMOVE) {
+    /* curl may already have closed it, in which case epoll has dropped it */
+    epoll_ctl (context->epoll_fd, EPOLL_CTL_DEL, s, NULL);
+    curl_multi_assign (context->multi_handle, s, NULL);
+    return 0;
+  }
+
+  memset (&ev, 0, sizeof (ev));
+  ev.data.fd = s;
+  if (what & CURL_POLL_IN) {
+    ev.events |= EPOLLIN;
+  }
+  if (what & CURL_POLL_OUT) {
+    ev.events |= EPOLLOUT;
+  }
+
+  if (socketp == NULL) {
+    if ((epoll_ctl (context->epoll_fd, EPOLL_CTL_ADD, s, &ev) != 0) &&
+        ((errno != EEXIST) ||
+            (epoll_ctl (context->epoll_fd, EPOLL_CTL_MOD, s, &ev) != 0))) {
+      GSTCURL_WARNING_PRINT ("Couldn't add socket %d to epoll set: %s",
+          (int) s, g_strerror (errno));
+      return -1;
+    }
+    curl_multi_assign (context->multi_handle, s, context);
+  } else if (epoll_ctl (context->epoll_fd, EPOLL_CTL_MOD, s, &ev) != 0) {
+    GSTCURL_WARNING_PRINT ("Couldn't modify socket %d in epoll set: %s",
+        (int) s, g_strerror (errno));
+    return -1;
+  }
+
+  return 0;
+}
+
+/*
+ * Called by curl to (re)arm its single timeout. -1 disarms the timer, and 0
+ * means "as soon as possible", which needs to be non-zero for timerfd as a
+ * zeroed itimerspec disarms it too.
+ */
+static int
+gst_curl_http_src_multi_timer_cb (CURLM * multi, long timeout_ms, void *userp)
+{
+  GstCurlHttpSrcMultiTaskContext *context = userp;
+  struct itimerspec its;
+
+  memset (&its, 0, sizeof (its));
+  if (timeout_ms > 0) {
+    its.it_value.tv_sec = timeout_ms / 1000;
+    its.it_value.tv_nsec = (timeout_ms % 1000) * 1000000;
+  } else if (timeout_ms == 0) {
+    its.it_value.tv_nsec = 1;
+  }
+
+  if (timerfd_settime (context->timer_fd, 0, &its, NULL) != 0) {
+    GSTCURL_WARNING_PRINT ("Couldn't arm curl timer: %s", g_strerror (errno));
+    return -1;
+  }
+
+  return 0;
+}
+
+/*
+ * Wait for activity on any of curl's sockets or its timer, and let curl deal
+ * with only the sockets that actually need it. Anything changing the loop
+ * state pokes the wakeup eventfd, so there's only need to time out (after
+ * timeout_ms, or -1 not to) when the loop has something of its own to do.
+ */
+static void
+gst_curl_http_src_multi_socket_wait (GstCurlHttpSrcMultiTaskContext * context,
+    int timeout_ms)
+{
+  struct epoll_event events[GSTCURL_MAX_EPOLL_EVENTS];
+  guint64 expirations;
+  int n, i, mask;
+
+  n = epoll_wait (context->epoll_fd, events, GSTCURL_MAX_EPOLL_EVENTS,
+      timeout_ms);
+  if (n < 0) {
+    if (errno != EINTR) {
+      GSTCURL_WARNING_PRINT ("epoll_wait failed: %s", g_strerror (errno));
+    }
+    return;
+  }
+
+  for (i = 0; i < n; i++) {
+    if (events[i].data.fd == context->timer_fd) {
+      if (read (context->timer_fd, &expirations, sizeof (expirations)) < 0) {
+        /* Already drained, nothing to worry about */
+      }
+      curl_multi_socket_action (context->multi_handle, CURL_SOCKET_TIMEOUT, 0,
+          &context->running_handles);
+    } else if (events[i].data.fd == context->wakeup_fd) {
+      /* Just reset the counter, the loop state is checked on return */
+      if (read (context->wakeup_fd, &expirations, sizeof (expirations)) < 0) {
+        /* Already drained, nothing to worry about */
       }
-      qelement = qelement->next;
+    } else {
+      mask = 0;
+      if (events[i].events & EPOLLIN) {
+        mask |= CURL_CSELECT_IN;
+      }
+      if (events[i].events & EPOLLOUT) {
+        mask |= CURL_CSELECT_OUT;
+      }
+      if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+        mask |= CURL_CSELECT_ERR;
+      }
+      curl_multi_socket_action (context->multi_handle, events[i].data.fd, mask,
+          &context->running_handles);
     }
-    context->request_removal_element = NULL;
-    context->state = GSTCURL_MULTI_LOOP_STATE_RUNNING;
-    g_mutex_unlock (&context->mutex);
-  } else {
-    GSTCURL_WARNING_PRINT ("Curl Loop State was invalid or unsupported");
-    GSTCURL_WARNING_PRINT ("Signal State is %d, resetting to RUNNING.",
-        context->state);
-    /* Reset to running, so if there isn't anything to do it'll be
-     * changed the WAIT once curl_multi_perform says it has no active
-     * handles. */
-    context->state = GSTCURL_MULTI_LOOP_STATE_RUNNING;
-    g_mutex_unlock (&context->mutex);
   }
 }
+#endif
 
 /*
  * Receive headers from the remote server and put them into the http_headers
@@ -1670,22 +5084,27 @@ gst_curl_http_src_get_header (void *header, size_t size, size_t nmemb,
 {
   GstCurlHttpSrc *s = src;
   char *substr;
+  gboolean followed;
 
   GST_DEBUG_OBJECT (s, "Received header: %s", (char *) header);
 
   g_mutex_lock (&s->buffer_mutex);
 
+  /*
+   * Nobody can start following once we have a status, so checking here means
+   * a follower gets every header line from the status line on.
+   */
+  followed = s->followed;
+
   if (s->state == GSTCURL_UNLOCK) {
-    g_mutex_unlock (&s->buffer_mutex);
-    return size * nmemb;
+    goto done;
   }
 
   if (s->http_headers == NULL) {
     /* Can't do anything here, so just silently swallow the header */
     GST_DEBUG_OBJECT (s, "HTTP Headers Structure has already been sent,"
         " ignoring header");
-    g_mutex_unlock (&s->buffer_mutex);
-    return size * nmemb;
+    goto done;
   }
 
   substr = gst_curl_http_src_strcasestr (header, "HTTP");
@@ -1712,6 +5131,11 @@ gst_curl_http_src_get_header (void *header, size_t size, size_t nmemb,
           s->status_code, s->uri, status_line_fields[2]);
       gst_structure_set (s->http_headers, HTTP_STATUS_CODE,
           G_TYPE_UINT, s->status_code, NULL);
+      /* What was negotiated, e.g. "HTTP/2" gives "2" */
+      if (g_str_has_prefix (status_line_fields[0], "HTTP/") == TRUE) {
+        gst_structure_set (s->http_headers, HTTP_VERSION_NAME,
+            G_TYPE_STRING, status_line_fields[0] + strlen ("HTTP/"), NULL);
+      }
       g_strfreev (status_line_fields);
     }
   } else {
@@ -1747,6 +5171,21 @@ gst_curl_http_src_get_header (void *header, size_t size, size_t nmemb,
       /* We have some special cases - deal with them here */
       if (g_strcmp0 (header_key, "content-type") == 0) {
         gst_curl_http_src_negotiate_caps (src);
+      } else if (g_strcmp0 (header_key, "accept-ranges") == 0) {
+        s->seekable = (g_ascii_strncasecmp (header_tpl[1], "none", 4) != 0);
+      } else if (g_strcmp0 (header_key, "content-range") == 0) {
+        /* Content-Range: bytes <first>-<last>/<total or *> */
+        gchar *total = strchr (header_tpl[1], '/');
+        if ((total != NULL) && g_ascii_isdigit (total[1])) {
+          s->content_size = g_ascii_strtoull (total + 1, NULL, 10);
+          s->have_size = TRUE;
+        }
+      } else if (g_strcmp0 (header_key, "etag") == 0) {
+        g_free (s->etag);
+        s->etag = g_strstrip (g_strdup (header_tpl[1]));
+      } else if (g_strcmp0 (header_key, "last-modified") == 0) {
+        g_free (s->last_modified);
+        s->last_modified = g_strstrip (g_strdup (header_tpl[1]));
       }
 
       g_free (header_key);
@@ -1756,8 +5195,13 @@ gst_curl_http_src_get_header (void *header, size_t size, size_t nmemb,
 
   s->hdrs_updated = TRUE;
 
+done:
   g_mutex_unlock (&s->buffer_mutex);
 
+  if (followed == TRUE) {
+    gst_curl_http_src_forward_header (s, header, size, nmemb);
+  }
+
   return size * nmemb;
 }
 
@@ -1798,30 +5242,558 @@ gst_curl_http_src_strcasestr (const char *haystack, const char *needle)
 
 /*
  * Receive chunks of the requested body and pass these back to the ::create()
- * loop
+ * loop. Each chunk is copied once, straight out of curl's buffer into the
+ * current receive block, which ::create() then hands downstream as it is.
  */
 static size_t
 gst_curl_http_src_get_chunks (void *chunk, size_t size, size_t nmemb, void *src)
 {
   GstCurlHttpSrc *s = src;
   size_t chunk_len = size * nmemb;
+  size_t offset, copy_len;
+  gboolean followed;
+  gdouble rate;
   GST_TRACE_OBJECT (s,
       "Received curl chunk for URI %s of size %d", s->uri, (int) chunk_len);
   g_mutex_lock (&s->buffer_mutex);
+  followed = s->followed;
   if (s->state == GSTCURL_UNLOCK) {
     g_mutex_unlock (&s->buffer_mutex);
+    if (followed == TRUE) {
+      gst_curl_http_src_forward_chunk (s, chunk, chunk_len);
+    }
     return chunk_len;
   }
-  s->buffer =
-      g_realloc (s->buffer, (s->buffer_len + chunk_len + 1) * sizeof (char));
-  if (s->buffer == NULL) {
-    GST_ERROR_OBJECT (s, "Realloc for cURL response message failed!\n");
-    return 0;
+
+  /*
+   * Don't take more than we've been allowed to hold. Pausing makes curl stop
+   * reading from the socket, so the server gets pushed back on instead of us
+   * growing without bound. curl hands the same chunk back once unpaused.
+   */
+  if ((s->max_buffer_bytes > 0) && (s->buffer_len > 0) &&
+      ((s->buffer_len + chunk_len) > s->max_buffer_bytes)) {
+    GST_DEBUG_OBJECT (s, "Holding %" G_GSIZE_FORMAT " bytes, pausing transfer",
+        s->buffer_len);
+    s->paused = TRUE;
+    s->bandwidth_sample_start = 0;
+    g_mutex_unlock (&s->buffer_mutex);
+    return CURL_WRITEFUNC_PAUSE;
+  }
+
+  /* Nor faster than we've been allowed to, see ::_shape() */
+  if (gst_curl_http_src_shape (s, s->priority, s->uri, &s->host_bucket,
+          chunk_len) == FALSE) {
+    s->bandwidth_sample_start = 0;
+    g_mutex_unlock (&s->buffer_mutex);
+    gst_curl_http_src_throttle (s, NULL);
+    return CURL_WRITEFUNC_PAUSE;
+  }
+
+  offset = 0;
+  while (offset < chunk_len) {
+    if ((s->block == NULL) && (gst_curl_http_src_open_block (s) == FALSE)) {
+      GST_ERROR_OBJECT (s, "Allocation for cURL response block failed!");
+      g_mutex_unlock (&s->buffer_mutex);
+      return 0;
+    }
+    copy_len = MIN (chunk_len - offset, s->block_map.size - s->block_fill);
+    memcpy (s->block_map.data + s->block_fill, (guint8 *) chunk + offset,
+        copy_len);
+    s->block_fill += copy_len;
+    offset += copy_len;
+    if (s->block_fill == s->block_map.size) {
+      gst_curl_http_src_close_block (s);
+    }
   }
-  memcpy (s->buffer + s->buffer_len, chunk, chunk_len);
   s->buffer_len += chunk_len;
+  rate = gst_curl_http_src_sample_bandwidth (s, chunk_len);
+
+  g_cond_signal (&s->signal);
+  g_mutex_unlock (&s->buffer_mutex);
+
+  /* Only what we've taken, so followers don't see a paused chunk twice */
+  if (followed == TRUE) {
+    gst_curl_http_src_forward_chunk (s, chunk, chunk_len);
+  }
+  if (rate > 0) {
+    gst_curl_http_src_update_bandwidth (s, s->uri, rate);
+  }
+  return chunk_len;
+}
+
+/*
+ * Time a chunk of the body as it arrives, whichever of our transfers it came
+ * in on, so that parts and prefetches running alongside count too. Once the
+ * sample has gone on for long enough, fold the rate over it into the
+ * element's moving average.
+ * Returns the rate, or 0 if the sample isn't over yet. Called with the
+ * buffer_mutex held.
+ */
+static gdouble
+gst_curl_http_src_sample_bandwidth (GstCurlHttpSrc * s, size_t chunk_len)
+{
+  gint64 now = g_get_monotonic_time ();
+  gdouble rate;
+
+  /* The first chunk arrived before there was anything to time it from */
+  if (s->bandwidth_sample_start == 0) {
+    s->bandwidth_sample_start = now;
+    s->bandwidth_sample_bytes = 0;
+    return 0;
+  }
+
+  s->bandwidth_sample_bytes += chunk_len;
+  if ((now - s->bandwidth_sample_start) < GSTCURL_BANDWIDTH_SAMPLE_TIME) {
+    return 0;
+  }
+
+  rate = (s->bandwidth_sample_bytes * 8.0 * G_USEC_PER_SEC) /
+      (now - s->bandwidth_sample_start);
+  if (s->bandwidth == 0) {
+    s->bandwidth = rate;
+  } else {
+    s->bandwidth += GSTCURL_BANDWIDTH_WEIGHT * (rate - s->bandwidth);
+  }
+  s->bandwidth_sample_start = now;
+  s->bandwidth_sample_bytes = 0;
+
+  return rate;
+}
+
+/*
+ * Fold a sample into the moving average on our worker for the host of uri,
+ * the transfer it finished on, and let the application know where the
+ * estimates are at, every so often. Called without the buffer_mutex held.
+ */
+static void
+gst_curl_http_src_update_bandwidth (GstCurlHttpSrc * s, const gchar * uri,
+    gdouble rate)
+{
+  GstCurlHttpSrcMultiTaskContext *context = s->context;
+  gint64 now = g_get_monotonic_time ();
+  gdouble *estimate, host_bandwidth, bandwidth;
+  gboolean post;
+  gchar *host;
+
+  host = gst_curl_http_src_uri_host (uri);
+  if (host == NULL) {
+    return;
+  }
+
+  g_mutex_lock (&context->mutex);
+  estimate = g_hash_table_lookup (context->host_bandwidth, host);
+  if (estimate == NULL) {
+    estimate = g_new (gdouble, 1);
+    *estimate = rate;
+    g_hash_table_insert (context->host_bandwidth, g_strdup (host), estimate);
+  } else {
+    *estimate += GSTCURL_BANDWIDTH_WEIGHT * (rate - *estimate);
+  }
+  host_bandwidth = *estimate;
+  g_mutex_unlock (&context->mutex);
+
+  g_mutex_lock (&s->buffer_mutex);
+  post = ((now - s->bandwidth_posted) >= GSTCURL_BANDWIDTH_MESSAGE_INTERVAL);
+  if (post == TRUE) {
+    s->bandwidth_posted = now;
+  }
+  bandwidth = s->bandwidth;
+  g_mutex_unlock (&s->buffer_mutex);
+
+  if (post == TRUE) {
+    gst_element_post_message (GST_ELEMENT_CAST (s),
+        gst_message_new_element (GST_OBJECT_CAST (s),
+            gst_structure_new (BANDWIDTH_ESTIMATE_NAME,
+                BANDWIDTH_ELEMENT, G_TYPE_UINT64, (guint64) bandwidth,
+                BANDWIDTH_HOST, G_TYPE_STRING, host,
+                BANDWIDTH_HOST_ESTIMATE, G_TYPE_UINT64,
+                (guint64) host_bandwidth, NULL)));
+  }
+  g_free (host);
+}
+
+/*
+ * Change how fast a bucket fills up. A new rate starts off with a full burst.
+ */
+static void
+gst_curl_http_src_bucket_set_rate (GstCurlHttpSrcBucket * bucket,
+    guint64 rate)
+{
+  if (bucket->rate != rate) {
+    bucket->rate = rate;
+    bucket->filled = 0;
+  }
+}
+
+/*
+ * Top a bucket up with whatever it has earned since it was last topped up.
+ */
+static void
+gst_curl_http_src_bucket_fill (GstCurlHttpSrcBucket * bucket, gint64 now)
+{
+  gdouble burst;
+
+  burst = (gdouble) bucket->rate * GSTCURL_SHAPING_BURST / G_USEC_PER_SEC;
+  if (bucket->filled == 0) {
+    bucket->tokens = burst;
+  } else {
+    bucket->tokens +=
+        (gdouble) bucket->rate * (now - bucket->filled) / G_USEC_PER_SEC;
+    if (bucket->tokens > burst) {
+      bucket->tokens = burst;
+    }
+  }
+  bucket->filled = now;
+}
+
+/*
+ * Shaping. Check whether one of our transfers can take chunk_len bytes now,
+ * against our own max-rate and the budgets shared by everyone on our worker
+ * for its host and in total, and take them out of those if so. If not, the
+ * caller pauses the transfer and has it throttled, see ::_throttle(), and the
+ * curl loop carries it on once there's bandwidth again. uri is what the
+ * transfer is fetching, and host_bucket where it keeps its host's bucket once
+ * it has been looked up. With a chunk_len of 0, this
+ * only checks. Live transfers (high priority) are never held back by the
+ * shared budgets, though what they take comes out of them, so everyone else
+ * slows down to make room. Called from our worker with the buffer_mutex held.
+ */
+static gboolean
+gst_curl_http_src_shape (GstCurlHttpSrc * s, GstCurlHttpSrcPriority priority,
+    const gchar * uri, GstCurlHttpSrcBucket ** host_bucket, size_t chunk_len)
+{
+  GstCurlHttpSrcMultiTaskContext *context = s->context;
+  GstCurlHttpSrcBucket *shared[2];
+  gboolean allowed = TRUE;
+  guint n_shared = 0, i;
+  gint64 now;
+
+  if ((s->bucket.rate == 0) && (context->total_bucket.rate == 0) &&
+      (context->host_rate == 0)) {
+    return TRUE;
+  }
+  now = g_get_monotonic_time ();
+
+  if (s->bucket.rate > 0) {
+    gst_curl_http_src_bucket_fill (&s->bucket, now);
+    allowed = (s->bucket.tokens > 0);
+  }
+
+  if (context->total_bucket.rate > 0) {
+    shared[n_shared++] = &context->total_bucket;
+  }
+  if (context->host_rate > 0) {
+    if (*host_bucket == NULL) {
+      gchar *host = gst_curl_http_src_uri_host (uri);
+
+      if (host != NULL) {
+        *host_bucket = g_hash_table_lookup (context->host_buckets, host);
+        if (*host_bucket == NULL) {
+          *host_bucket = g_new0 (GstCurlHttpSrcBucket, 1);
+          (*host_bucket)->rate = context->host_rate;
+          g_hash_table_insert (context->host_buckets, host, *host_bucket);
+          host = NULL;
+        }
+        g_free (host);
+      }
+    }
+    if (*host_bucket != NULL) {
+      shared[n_shared++] = *host_bucket;
+    }
+  }
+  for (i = 0; i < n_shared; i++) {
+    gst_curl_http_src_bucket_fill (shared[i], now);
+    if ((shared[i]->tokens <= 0) &&
+        (priority != GST_CURL_HTTP_SRC_PRIORITY_HIGH)) {
+      allowed = FALSE;
+    }
+  }
+
+  if ((allowed == TRUE) && (chunk_len > 0)) {
+    if (s->bucket.rate > 0) {
+      s->bucket.tokens -= chunk_len;
+    }
+    for (i = 0; i < n_shared; i++) {
+      shared[i]->tokens -= chunk_len;
+    }
+  }
+
+  return allowed;
+}
+
+/*
+ * Have the curl loop carry on our transfer, or one of our parts, once
+ * there's bandwidth for it again, after ::_shape() has held it back. Called
+ * from our worker without the buffer_mutex held.
+ */
+static void
+gst_curl_http_src_throttle (GstCurlHttpSrc * s, GstCurlHttpSrcPart * part)
+{
+  GstCurlHttpSrcMultiTaskContext *context = s->context;
+  GstCurlHttpSrcQueueElement *qelement;
+
+  g_mutex_lock (&context->mutex);
+  qelement = (part != NULL) ? part->queue_element : s->queue_element;
+  if (qelement != NULL) {
+    gst_curl_http_src_throttle_queue_item (qelement);
+  }
+  g_mutex_unlock (&context->mutex);
+}
+
+/*
+ * Pass a header line of our transfer on to everyone following it, just as if
+ * it had come from their own. Called from the curl callbacks without our
+ * buffer_mutex held.
+ */
+static void
+gst_curl_http_src_forward_header (GstCurlHttpSrc * s, void *header,
+    size_t size, size_t nmemb)
+{
+  GstCurlHttpSrcMultiTaskContext *context = s->context;
+  GSList *link;
+
+  g_mutex_lock (&context->mutex);
+  if (s->queue_element != NULL) {
+    for (link = s->queue_element->followers; link != NULL; link = link->next) {
+      gst_curl_http_src_get_header (header, size, nmemb, link->data);
+    }
+  }
+  g_mutex_unlock (&context->mutex);
+}
+
+/*
+ * Pass a chunk of our transfer on to everyone following it. The chunk is only
+ * copied the once, and each follower queues a reference to the same memory.
+ * A follower that can't keep up is cut loose to carry on by itself, rather
+ * than holding up the transfer for everyone else.
+ */
+static void
+gst_curl_http_src_forward_chunk (GstCurlHttpSrc * s, void *chunk,
+    size_t chunk_len)
+{
+  GstCurlHttpSrcMultiTaskContext *context = s->context;
+  GstBuffer *buf, *tail;
+  GSList *link, *next;
+
+  buf = gst_buffer_new_allocate (NULL, chunk_len, NULL);
+  if (buf == NULL) {
+    GST_ERROR_OBJECT (s, "Allocation for shared chunk failed!");
+    return;
+  }
+  gst_buffer_fill (buf, 0, chunk, chunk_len);
+
+  g_mutex_lock (&context->mutex);
+  if (s->queue_element != NULL) {
+    for (link = s->queue_element->followers; link != NULL; link = next) {
+      GstCurlHttpSrc *follower = link->data;
+      gboolean behind;
+
+      next = link->next;
+      g_mutex_lock (&follower->buffer_mutex);
+      behind = (follower->max_buffer_bytes > 0) &&
+          (follower->buffer_len > 0) &&
+          ((follower->buffer_len + chunk_len) > follower->max_buffer_bytes);
+      if (behind == FALSE) {
+        /* Keep the blocks going downstream about the negotiated size */
+        tail = g_queue_peek_tail (&follower->buffer_queue);
+        if ((tail != NULL) &&
+            (gst_buffer_get_size (tail) < follower->block_size)) {
+          tail = gst_buffer_append (g_queue_pop_tail (&follower->buffer_queue),
+              gst_buffer_ref (buf));
+          g_queue_push_tail (&follower->buffer_queue, tail);
+        } else {
+          g_queue_push_tail (&follower->buffer_queue, gst_buffer_ref (buf));
+        }
+        follower->buffer_len += chunk_len;
+        g_cond_signal (&follower->signal);
+      }
+      g_mutex_unlock (&follower->buffer_mutex);
+
+      if (behind == TRUE) {
+        GST_DEBUG_OBJECT (follower, "Fell behind shared transfer for URI %s",
+            follower->uri);
+        gst_curl_http_src_unfollow_queue_item (follower);
+        g_mutex_lock (&follower->buffer_mutex);
+        if (follower->state != GSTCURL_UNLOCK) {
+          follower->state = GSTCURL_DONE;
+        } else {
+          follower->pending_state = GSTCURL_DONE;
+        }
+        follower->curl_result = CURLE_PARTIAL_FILE;
+        g_cond_signal (&follower->signal);
+        g_mutex_unlock (&follower->buffer_mutex);
+      }
+    }
+  }
+  g_mutex_unlock (&context->mutex);
+
+  gst_buffer_unref (buf);
+}
+
+/*
+ * Receive chunks for one part of a parallel download. These are held on the
+ * part until ::create() gets round to it; there are few enough parts that
+ * there's no need to pause them.
+ */
+static size_t
+gst_curl_http_src_get_part_chunks (void *chunk, size_t size, size_t nmemb,
+    void *p)
+{
+  GstCurlHttpSrcPart *part = p;
+  GstCurlHttpSrc *s = part->src;
+  size_t chunk_len = size * nmemb;
+  glong status = 0;
+  GstBuffer *buf;
+  gboolean allowed;
+  gdouble rate;
+
+  /* Anything other than a 206 isn't the range we asked for, so stop here */
+  curl_easy_getinfo (part->handle, CURLINFO_RESPONSE_CODE, &status);
+  if (status != 206) {
+    GST_WARNING_OBJECT (s, "Got status %ld instead of a range for URI %s",
+        status, s->uri);
+    return 0;
+  }
+
+  /* Parts come out of the same budgets as our own transfer */
+  g_mutex_lock (&s->buffer_mutex);
+  allowed = gst_curl_http_src_shape (s, s->priority, s->uri,
+      &s->host_bucket, chunk_len);
+  g_mutex_unlock (&s->buffer_mutex);
+  if (allowed == FALSE) {
+    gst_curl_http_src_throttle (s, part);
+    return CURL_WRITEFUNC_PAUSE;
+  }
+
+  buf = gst_buffer_new_allocate (NULL, chunk_len, NULL);
+  if (buf == NULL) {
+    GST_ERROR_OBJECT (s, "Allocation for part chunk failed!");
+    return 0;
+  }
+  gst_buffer_fill (buf, 0, chunk, chunk_len);
+
+  g_mutex_lock (&s->buffer_mutex);
+  g_queue_push_tail (&part->buffers, buf);
+  part->len += chunk_len;
+  part->start += chunk_len;
+  rate = gst_curl_http_src_sample_bandwidth (s, chunk_len);
   g_cond_signal (&s->signal);
   g_mutex_unlock (&s->buffer_mutex);
+
+  if (rate > 0) {
+    gst_curl_http_src_update_bandwidth (s, s->uri, rate);
+  }
+  return chunk_len;
+}
+
+/*
+ * Header callback for a prefetch. Headers are kept the same way as
+ * gst_curl_http_src_get_header() keeps ours, so they can be passed on as they
+ * are if the prefetch is taken over.
+ */
+static size_t
+gst_curl_http_src_get_prefetch_header (void *header, size_t size,
+    size_t nmemb, void *p)
+{
+  GstCurlHttpSrcPart *prefetch = p;
+  GstCurlHttpSrc *s = prefetch->src;
+  gchar *line, *value;
+  gchar **fields;
+  const gchar *old;
+
+  line = g_strndup (header, size * nmemb);
+  g_mutex_lock (&s->buffer_mutex);
+
+  if (g_ascii_strncasecmp (line, "HTTP", 4) == 0) {
+    /* A new status line, i.e. after a redirect, starts the headers over */
+    fields = g_strsplit (line, " ", 3);
+    if ((fields[0] != NULL) && (fields[1] != NULL)) {
+      prefetch->status_code = (guint) g_ascii_strtoll (fields[1], NULL, 10);
+    }
+    gst_structure_remove_all_fields (prefetch->headers);
+  } else {
+    fields = g_strsplit (line, ": ", 2);
+    if ((fields[0] != NULL) && (fields[1] != NULL)) {
+      gchar *key = g_ascii_strdown (fields[0], -1);
+      old = gst_structure_get_string (prefetch->headers, key);
+      if (old != NULL) {
+        value = g_strdup_printf ("%s, %s", old, fields[1]);
+        gst_structure_set (prefetch->headers, key, G_TYPE_STRING, value,
+            NULL);
+        g_free (value);
+      } else {
+        gst_structure_set (prefetch->headers, key, G_TYPE_STRING, fields[1],
+            NULL);
+      }
+      g_free (key);
+    }
+  }
+
+  g_strfreev (fields);
+  g_mutex_unlock (&s->buffer_mutex);
+  g_free (line);
+
+  return size * nmemb;
+}
+
+/*
+ * Write callback for a prefetch. Once max-buffer-bytes have come in we stop,
+ * and if the prefetch gets taken over, the rest is fetched from there.
+ */
+static size_t
+gst_curl_http_src_get_prefetch_chunks (void *chunk, size_t size,
+    size_t nmemb, void *p)
+{
+  GstCurlHttpSrcPart *prefetch = p;
+  GstCurlHttpSrc *s = prefetch->src;
+  size_t chunk_len = size * nmemb;
+  GstBuffer *buf, *tail;
+  gdouble rate;
+
+  buf = gst_buffer_new_allocate (NULL, chunk_len, NULL);
+  if (buf == NULL) {
+    GST_ERROR_OBJECT (s, "Allocation for prefetch chunk failed!");
+    return 0;
+  }
+  gst_buffer_fill (buf, 0, chunk, chunk_len);
+
+  g_mutex_lock (&s->buffer_mutex);
+  if (prefetch->cancelled == TRUE) {
+    g_mutex_unlock (&s->buffer_mutex);
+    gst_buffer_unref (buf);
+    return 0;
+  }
+  if ((s->max_buffer_bytes > 0) &&
+      (prefetch->len + chunk_len > s->max_buffer_bytes)) {
+    GST_DEBUG_OBJECT (s, "Prefetched as much of URI %s as we'll hold",
+        prefetch->uri);
+    prefetch->truncated = TRUE;
+    g_mutex_unlock (&s->buffer_mutex);
+    gst_buffer_unref (buf);
+    return 0;
+  }
+  if (gst_curl_http_src_shape (s, GST_CURL_HTTP_SRC_PRIORITY_LOW,
+          prefetch->uri, &prefetch->host_bucket, chunk_len) == FALSE) {
+    g_mutex_unlock (&s->buffer_mutex);
+    gst_buffer_unref (buf);
+    gst_curl_http_src_throttle (s, prefetch);
+    return CURL_WRITEFUNC_PAUSE;
+  }
+
+  /* curl hands over small chunks, so gather them up into blocks */
+  tail = g_queue_peek_tail (&prefetch->buffers);
+  if ((tail != NULL) && (gst_buffer_get_size (tail) < s->block_size)) {
+    g_queue_pop_tail (&prefetch->buffers);
+    buf = gst_buffer_append (tail, buf);
+  }
+  g_queue_push_tail (&prefetch->buffers, buf);
+  prefetch->len += chunk_len;
+  rate = gst_curl_http_src_sample_bandwidth (s, chunk_len);
+  g_mutex_unlock (&s->buffer_mutex);
+
+  if (rate > 0) {
+    gst_curl_http_src_update_bandwidth (s, prefetch->uri, rate);
+  }
   return chunk_len;
 }
 
@@ -1831,15 +5803,59 @@ gst_curl_http_src_get_chunks (void *chunk, size_t size, size_t nmemb, void *src)
 static void
 gst_curl_http_src_request_remove (GstCurlHttpSrc * src)
 {
-  GstCurlHttpSrcClass *klass = G_TYPE_INSTANCE_GET_CLASS (src,
-      GST_TYPE_CURL_HTTP_SRC,
-      GstCurlHttpSrcClass);
-  g_mutex_lock (&klass->multi_task_context.mutex);
+  GstCurlHttpSrcMultiTaskContext *context = src->context;
+
+  if (context == NULL) {
+    /* Never started a transfer, so there's nothing to remove */
+    return;
+  }
+  g_mutex_lock (&context->mutex);
+
+  context->state = GSTCURL_MULTI_LOOP_STATE_REQUEST_REMOVAL;
+  context->removal_requests = g_slist_prepend (context->removal_requests, src);
+  gst_curl_http_src_multi_wakeup (context);
+  g_mutex_unlock (&context->mutex);
+}
+
+/*
+ * Ask the curl loop to resume a transfer paused by get_chunks. curl handles
+ * can only be unpaused from the thread driving the multi handle.
+ */
+static void
+gst_curl_http_src_request_unpause (GstCurlHttpSrc * src)
+{
+  GstCurlHttpSrcMultiTaskContext *context = src->context;
+
+  if (context == NULL) {
+    return;
+  }
+  g_mutex_lock (&context->mutex);
+
+  context->unpause_requests = g_slist_prepend (context->unpause_requests, src);
+  gst_curl_http_src_multi_wakeup (context);
+  g_mutex_unlock (&context->mutex);
+}
+
+/*
+ * Locking for the share handle, which is used from every worker thread (and
+ * from ::create() when easy handles are set up). One mutex per type of data.
+ */
+static void
+gst_curl_http_src_share_lock (CURL * handle, curl_lock_data data,
+    curl_lock_access access, void *userptr)
+{
+  GstCurlHttpSrcClass *klass = userptr;
+
+  g_mutex_lock (&klass->share_mutex[data]);
+}
+
+static void
+gst_curl_http_src_share_unlock (CURL * handle, curl_lock_data data,
+    void *userptr)
+{
+  GstCurlHttpSrcClass *klass = userptr;
 
-  klass->multi_task_context.state = GSTCURL_MULTI_LOOP_STATE_REQUEST_REMOVAL;
-  klass->multi_task_context.request_removal_element = src;
-  g_cond_signal (&klass->multi_task_context.signal);
-  g_mutex_unlock (&klass->multi_task_context.mutex);
+  g_mutex_unlock (&klass->share_mutex[data]);
 }
 
 /*****************************************************************************
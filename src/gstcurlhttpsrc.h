@@ -75,6 +75,8 @@ G_BEGIN_DECLS
   (G_TYPE_CHECK_INSTANCE_TYPE((obj),GST_TYPE_CURLHTTPSRC))
 #define GST_IS_CURLHTTPSRC_CLASS(klass) \
   (G_TYPE_CHECK_CLASS_TYPE((klass),GST_TYPE_CURLHTTPSRC))
+#define GST_TYPE_CURL_HTTP_SRC_PRIORITY \
+  (gst_curl_http_src_priority_get_type())
 /* Because g_param_spec_int requires min/max bounding... */
 #define GSTCURL_MIN_REDIRECTIONS -1
 #define GSTCURL_MAX_REDIRECTIONS 255
@@ -90,6 +92,40 @@ G_BEGIN_DECLS
 #define GSTCURL_DEFAULT_CONNECTIONS_SERVER 5
 #define GSTCURL_DEFAULT_CONNECTIONS_PROXY 30
 #define GSTCURL_DEFAULT_CONNECTIONS_GLOBAL 255
+#define GSTCURL_MIN_POOL_DEPTH 0
+#define GSTCURL_MAX_POOL_DEPTH 1024
+#define GSTCURL_DEFAULT_POOL_DEPTH 16
+#define GSTCURL_DEFAULT_BLOCK_SIZE (64 * 1024)
+#define GSTCURL_MIN_BUFFER_BYTES 0
+#define GSTCURL_MAX_BUFFER_BYTES G_MAXINT
+#define GSTCURL_DEFAULT_BUFFER_BYTES (4 * 1024 * 1024)
+#define GSTCURL_MAX_EPOLL_EVENTS 64
+#define GSTCURL_MIN_WORKER_THREADS 1
+#define GSTCURL_MAX_WORKER_THREADS 64
+#define GSTCURL_DEFAULT_WORKER_THREADS 1
+#define GSTCURL_MAX_POOLED_HANDLES 64
+#define GSTCURL_RANGE_BLOCK_SIZE (256 * 1024)
+#define GSTCURL_RANGE_CACHE_BLOCKS 16
+#define GSTCURL_MIN_PARALLEL_RANGES 1
+#define GSTCURL_MAX_PARALLEL_RANGES 16
+#define GSTCURL_DEFAULT_PARALLEL_RANGES 1
+#define GSTCURL_PARALLEL_PART_SIZE (4 * 1024 * 1024)
+#define GSTCURL_MAX_PREFETCH_URIS 4
+#define GSTCURL_DEFAULT_RESPONSE_CACHE_SIZE (32 * 1024 * 1024)
+#define GSTCURL_MAX_VALIDATED_RESPONSES 8
+#define GSTCURL_BANDWIDTH_SAMPLE_TIME (100 * G_TIME_SPAN_MILLISECOND)
+#define GSTCURL_BANDWIDTH_WEIGHT 0.2
+#define GSTCURL_BANDWIDTH_MESSAGE_INTERVAL G_TIME_SPAN_SECOND
+#define GSTCURL_STREAM_WEIGHT_HIGH 256
+#define GSTCURL_STREAM_WEIGHT_NORMAL 16
+#define GSTCURL_STREAM_WEIGHT_LOW 1
+#define GSTCURL_MIN_ACTIVE_TRANSFERS 0
+#define GSTCURL_MAX_ACTIVE_TRANSFERS 1024
+#define GSTCURL_DEFAULT_ACTIVE_TRANSFERS 0
+#define GSTCURL_SHAPING_BURST (100 * G_TIME_SPAN_MILLISECOND)
+#define GSTCURL_SHAPING_INTERVAL_MS 10
+#define GSTCURL_DEFAULT_CACHE_DIRECTORY_SIZE \
+    (G_GUINT64_CONSTANT (1024) * 1024 * 1024)
 #define GSTCURL_INFO_RESPONSE(x) ((x >= 100) && (x <= 199))
 #define GSTCURL_SUCCESS_RESPONSE(x) ((x >= 200) && (x <=299))
 #define GSTCURL_REDIRECT_RESPONSE(x) ((x >= 300) && (x <= 399))
@@ -107,25 +143,162 @@ typedef struct _GstCurlHttpSrc GstCurlHttpSrc;
 typedef struct _GstCurlHttpSrcClass GstCurlHttpSrcClass;
 typedef struct _GstCurlHttpSrcMultiTaskContext GstCurlHttpSrcMultiTaskContext;
 typedef struct _GstCurlHttpSrcQueueElement GstCurlHttpSrcQueueElement;
+typedef struct _GstCurlHttpSrcQueue GstCurlHttpSrcQueue;
+typedef struct _GstCurlHttpSrcPart GstCurlHttpSrcPart;
+typedef struct _GstCurlHttpSrcBucket GstCurlHttpSrcBucket;
+typedef struct _GstCurlHttpSrcDiskCommit GstCurlHttpSrcDiskCommit;
+
+/*
+ * How urgent an element's transfers are, see the priority property. Over
+ * HTTP/2 each maps to a stream weight, GSTCURL_STREAM_WEIGHT_*.
+ */
+typedef enum
+{
+  GST_CURL_HTTP_SRC_PRIORITY_HIGH,
+  GST_CURL_HTTP_SRC_PRIORITY_NORMAL,
+  GST_CURL_HTTP_SRC_PRIORITY_LOW
+} GstCurlHttpSrcPriority;
+#define GSTCURL_PRIORITY_CLASSES (GST_CURL_HTTP_SRC_PRIORITY_LOW + 1)
 
 #define HTTP_HEADERS_NAME       "http-headers"
 #define HTTP_STATUS_CODE        "http-status-code"
+#define HTTP_VERSION_NAME       "http-version"
 #define URI_NAME                "uri"
 #define REQUEST_HEADERS_NAME    "request-headers"
 #define RESPONSE_HEADERS_NAME   "response-headers"
 #define REDIRECT_URI_NAME       "redirection-uri"
+#define NOT_MODIFIED_NAME       "not-modified"
+
+#define HANDLE_POOL_STATS_NAME  "handle-pool-stats"
+#define HANDLE_POOL_HITS        "hits"
+#define HANDLE_POOL_MISSES      "misses"
+#define HANDLE_POOL_IDLE        "idle"
+
+#define TRANSFER_TIMING_NAME    "transfer-timing"
+#define TIMING_DNS              "dns-time"
+#define TIMING_CONNECT          "connect-time"
+#define TIMING_TLS              "tls-time"
+#define TIMING_FIRST_BYTE       "first-byte-time"
+#define TIMING_TOTAL            "total-time"
+#define TIMING_BYTES            "bytes"
+#define TIMING_SPEED            "speed"
+#define TIMING_REUSED           "connection-reused"
+
+#define BANDWIDTH_ESTIMATE_NAME "bandwidth-estimate"
+#define BANDWIDTH_ELEMENT       "bandwidth"
+#define BANDWIDTH_HOST          "host"
+#define BANDWIDTH_HOST_ESTIMATE "host-bandwidth"
+
+/*
+ * A queue of transfers, see gstcurlqueue.c. Keeping the tail means adding to
+ * the end doesn't have to walk the whole list. Those that shaping has paused
+ * are kept track of as well, so that only they need looking at to see if
+ * there's bandwidth for them again.
+ */
+struct _GstCurlHttpSrcQueue
+{
+  GstCurlHttpSrcQueueElement *head;
+  GstCurlHttpSrcQueueElement *tail;
+  guint length;
+  guint class_length[GSTCURL_PRIORITY_CLASSES];  /* By priority */
+  GQueue throttled;             /* Of GstCurlHttpSrcQueueElement */
+};
+
+/*
+ * A token bucket, for shaping how fast transfers take data in. The tokens are
+ * bytes, topped up at rate bytes a second to at most GSTCURL_SHAPING_BURST's
+ * worth. A transfer can take a chunk while there are any tokens left, which
+ * can leave the bucket owing some.
+ */
+struct _GstCurlHttpSrcBucket
+{
+  guint64 rate;                 /* 0 for no limit */
+  gdouble tokens;
+  gint64 filled;                /* When last topped up, 0 to start full */
+};
+
+/*
+ * A response body that has been written out to a cache directory, waiting to
+ * be put in place once its source has let go of the buffer_mutex. It has its
+ * own copy of everything, so the source can carry on in the meantime.
+ */
+struct _GstCurlHttpSrcDiskCommit
+{
+  gchar *directory;
+  guint64 max_size;             /* cache-directory-size */
+  gchar *uri;
+  GstStructure *request_headers;  /* Or NULL */
+  GstStructure *headers;
+  gint fd;
+  gchar *file;                  /* Temporary file fd is open on */
+  guint64 size;
+  gint64 lifetime;
+};
+
+/*
+ * One range of a parallel download, see the parallel-ranges property, or the
+ * whole of a URI being prefetched, see prefetch-uris. Parts belong to their
+ * GstCurlHttpSrc and are protected by its buffer_mutex, apart from
+ * queue_element which the context mutex looks after.
+ */
+struct _GstCurlHttpSrcPart
+{
+  GstCurlHttpSrc *src;
+  CURL *handle;
+  struct curl_slist *slist;
+  GstCurlHttpSrcQueueElement *queue_element;
+  guint64 start;                /* Next byte wanted from the server */
+  guint64 stop;
+  GQueue buffers;               /* Received and waiting to go downstream */
+  gsize len;
+  gboolean queued;              /* Handed over to the curl loop */
+  gboolean done;
+  CURLcode result;
+  char errbuf[CURL_ERROR_SIZE];
+
+  /* Prefetches only */
+  gchar *uri;
+  GstStructure *headers;        /* Response headers, as in http-headers */
+  guint status_code;
+  gboolean truncated;           /* Stopped at max-buffer-bytes */
+  gboolean cancelled;           /* No longer wanted, drop it once it's done */
+  GstCurlHttpSrcBucket *host_bucket;  /* On our worker, NULL if not found yet */
+};
 
 struct _GstCurlHttpSrcMultiTaskContext
 {
+  guint       id;
   GstTask     *task;
   GRecMutex   task_rec_mutex;
   GMutex      mutex;
   guint       refcount;
   GCond       signal;
 
-  GstCurlHttpSrc  *request_removal_element;
+  GSList          *removal_requests;
+  GSList          *unpause_requests;
+
+  GstCurlHttpSrcQueue  queue;           /* Handles added to multi_handle */
+  GstCurlHttpSrcQueue  pending_queue;   /* Handles waiting to be added */
+  GHashTable          *host_bandwidth;  /* Host to estimate, gdouble bit/s */
 
-  GstCurlHttpSrcQueueElement  *queue;
+  /*
+   * Connection limits for the multi handle. Every instance that queues a
+   * transfer here merges in its own, the largest winning, and the worker
+   * passes them on to curl next time it adds handles.
+   */
+  guint max_host_connections;   /* CURLMOPT_MAX_HOST_CONNECTIONS */
+  guint max_total_connections;  /* CURLMOPT_MAX_TOTAL_CONNECTIONS */
+  guint64 max_host_rate;        /* Bits per second, 0 for no limit, */
+  guint64 max_total_rate;       /* the strictest asked for winning */
+  gboolean limits_changed;
+
+  /*
+   * Shaping budgets, shared by everything on this worker. Only the worker
+   * touches these, from the loop or curl's callbacks, so they need no lock.
+   */
+  GstCurlHttpSrcBucket total_bucket;
+  guint64 host_rate;            /* Bytes per second, for each host bucket */
+  GHashTable *host_buckets;     /* Host to GstCurlHttpSrcBucket */
 
   enum
   {
@@ -139,13 +312,65 @@ struct _GstCurlHttpSrcMultiTaskContext
 
   /* < private > */
   CURLM *multi_handle;
+  gint running_handles;
+
+  /* Only used when the loop is driven by epoll, see gstcurlhttpsrc.c */
+  gint epoll_fd;
+  gint timer_fd;
+  gint wakeup_fd;
 };
 
 struct _GstCurlHttpSrcClass
 {
   GstPushSrcClass parent_class;
 
-  GstCurlHttpSrcMultiTaskContext multi_task_context;
+  /*
+   * One context, each with its own multi handle and thread, per curl worker.
+   * Set from the GST_CURL_WORKER_THREADS and GST_CURL_WORKER_POLICY
+   * environment variables when the class is initialised.
+   */
+  GstCurlHttpSrcMultiTaskContext multi_task_context[GSTCURL_MAX_WORKER_THREADS];
+  guint n_workers;
+  enum
+  {
+    GSTCURL_WORKER_POLICY_HOST_AFFINITY = 0,
+    GSTCURL_WORKER_POLICY_LEAST_LOADED
+  } worker_policy;
+
+  /*
+   * Shared by every easy handle, whichever worker runs it, so DNS results
+   * and TLS sessions carry over between transfers. Connections are only
+   * shared when there is a single worker.
+   */
+  CURLSH *share_handle;
+  GMutex share_mutex[CURL_LOCK_DATA_LAST];
+
+  /*
+   * Finished easy handles, reset and waiting to be reused rather than being
+   * cleaned up and created again for every request.
+   */
+  GMutex handle_pool_mutex;
+  GQueue handle_pool;
+  guint64 handle_pool_hits;
+  guint64 handle_pool_misses;
+
+  /*
+   * Complete responses kept for instances with response-cache set, by URI,
+   * most recently used first and within response_cache_budget bytes. See
+   * gstcurlcache.c.
+   */
+  GMutex response_cache_mutex;
+  GHashTable *response_cache;
+  GQueue response_cache_lru;
+  gsize response_cache_size;
+  gsize response_cache_budget;
+
+  /*
+   * Where curl keeps the Alt-Svc cache, so it knows which servers to try
+   * HTTP/3 with straight away. From GST_CURL_ALTSVC_FILE if it's set, NULL if
+   * curl can't do HTTP/3.
+   */
+  gchar *altsvc_file;
 };
 
 /*
@@ -189,12 +414,24 @@ struct _GstCurlHttpSrc
   gint total_retries;
   gint retries_remaining;
 
-  /*TODO As the following are all multi options, move these to curl task */
-  guint max_connection_time;    /* */
+  GstCurlHttpSrcPriority priority;  /* CURLOPT_STREAM_WEIGHT */
+  guint max_active_transfers;   /* Of our priority, before ours have to wait */
+
+  /*
+   * Shaping. Only the worker running our transfer touches the buckets, and
+   * then only once it has been queued.
+   */
+  guint64 max_rate;             /* Bits per second, 0 for no limit */
+  guint64 max_host_rate;        /* Merged into our context's, see there */
+  guint64 max_total_rate;
+  GstCurlHttpSrcBucket bucket;
+  GstCurlHttpSrcBucket *host_bucket;  /* On our worker, NULL if not found yet */
+
+  /* The last three are merged into our context's limits when we queue */
+  guint max_connection_time;    /* CURLOPT_MAXAGE_CONN */
   guint max_conns_per_server;   /* CURLMOPT_MAX_HOST_CONNECTIONS */
-  guint max_conns_per_proxy;    /* ?!? */
-  guint max_conns_global;       /* CURLMOPT_MAXCONNECTS */
-  /* END multi options */
+  guint max_conns_per_proxy;    /* Same, but when going through a proxy */
+  guint max_conns_global;       /* CURLMOPT_MAX_TOTAL_CONNECTIONS */
 
   /* Some stuff for HTTP/2 */
   enum
@@ -203,10 +440,14 @@ struct _GstCurlHttpSrc
     GSTCURL_HTTP_VERSION_1_1,
 #ifdef CURL_VERSION_HTTP2
     GSTCURL_HTTP_VERSION_2_0,
+#endif
+#ifdef CURL_VERSION_HTTP3
+    GSTCURL_HTTP_VERSION_3_0,
 #endif
     GSTCURL_HTTP_NOT,           /* For future use, incase not HTTP protocol! */
     GSTCURL_HTTP_VERSION_MAX
   } preferred_http_version;     /* CURLOPT_HTTP_VERSION */
+  gboolean http3_failed;        /* So use HTTP/2 instead from now on */
 
   enum
   {
@@ -221,13 +462,118 @@ struct _GstCurlHttpSrc
     GSTCURL_MAX
   } state, pending_state;
   CURL *curl_handle;
+  GstCurlHttpSrcMultiTaskContext *context;   /* Worker running our transfer */
+  GstCurlHttpSrcQueueElement *queue_element; /* Protected by context mutex */
   GMutex buffer_mutex;
   GCond signal;
-  gchar *buffer;
-  guint buffer_len;
+  GQueue buffer_queue;          /* Filled blocks waiting for ::create() */
+  gsize buffer_len;             /* Bytes in buffer_queue and the open block */
+
+  /*
+   * Receive blocks. get_chunks fills fixed-size buffers from the negotiated
+   * pool, one at a time, and queues each one as it becomes full.
+   */
+  GstBufferPool *pool;
+  guint pool_depth;
+  guint block_size;
+  GstBuffer *block;             /* Block currently being filled, or NULL */
+  GstMapInfo block_map;
+  gsize block_fill;
+
+  /*
+   * Flow control. Once max_buffer_bytes are waiting for ::create(), the
+   * transfer is paused until at least half of it has been drained.
+   */
+  guint max_buffer_bytes;
+  gboolean paused;
   gboolean transfer_begun;
   gboolean data_received;
 
+  /*
+   * Byte ranges. request_position is where the next transfer starts from and
+   * read_position is the offset of the next byte to be pushed downstream.
+   */
+  guint64 request_position;     /* CURLOPT_RANGE */
+  guint64 stop_position;        /* -1 to read to the end of the resource */
+  guint64 read_position;
+  guint64 content_size;         /* Size of the whole resource, if have_size */
+  gboolean have_size;
+  gboolean seekable;            /* Cleared if the server won't do ranges */
+  gchar *etag;                  /* Validators for If-Range, so a resumed */
+  gchar *last_modified;         /* transfer can't splice two versions */
+
+  /*
+   * Pull mode. Reads are served from a small cache of aligned blocks, most
+   * recently used first, each one tagged with its offset (GST_BUFFER_OFFSET).
+   */
+  GQueue range_cache;
+
+  /*
+   * Parallel ranges. The first transfer only asks for one part, and if that
+   * tells us the size, the rest comes in parts over up to parallel_ranges
+   * connections at once and is handed downstream in order.
+   */
+  guint parallel_ranges;
+  guint64 transfer_stop;        /* Where the running transfer stops */
+  guint64 next_part_start;
+  GQueue parts;                 /* GstCurlHttpSrcPart, in order */
+  gboolean parallel_disabled;
+
+  /*
+   * Prefetching. Each of the prefetch-uris is downloaded in the background,
+   * up to max-buffer-bytes of it, and taken over by ::create() if the
+   * element's URI is later set to it.
+   */
+  GQueue prefetches;            /* GstCurlHttpSrcPart, in the order given */
+
+  /*
+   * Coalescing. A request for something that another source on the same
+   * context is already waiting on follows that transfer rather than making
+   * its own, see gstcurlqueue.c.
+   */
+  GstCurlHttpSrcQueueElement *following; /* Protected by context mutex */
+  gboolean followed;            /* Our transfer has followers */
+
+  /*
+   * Response cache. While a cacheable response goes downstream, a copy of it
+   * is kept here, ready to go into the cache once it's all arrived.
+   */
+  gboolean response_cache;
+  GByteArray *cache_body;
+  GstStructure *cache_headers;
+  gint64 cache_lifetime;
+
+  /*
+   * On-disk cache. The response is written out as it goes downstream, and a
+   * stale response found there is revalidated with the server before use.
+   */
+  gchar *cache_directory;
+  guint64 cache_directory_size;
+  gint cache_fd;                /* Temporary file for the body, or -1 */
+  gchar *cache_file;
+  guint64 cache_file_size;
+  GstStructure *stale_headers;  /* Stale response we've asked the server */
+  GstBuffer *stale_body;        /* about, from the cache directory or below */
+
+  /*
+   * Revalidation. The last few responses that came with an ETag or
+   * Last-Modified header, so that fetching one again (a live manifest, say)
+   * is a conditional request, and a 304 just delivers the same body again.
+   */
+  gboolean revalidate;
+  GQueue validated;             /* GstCurlHttpSrcCacheEntry, latest first */
+
+  /*
+   * Bandwidth estimation. The chunk callbacks time the body as it arrives,
+   * along with any parts and prefetches, over samples of at least
+   * GSTCURL_BANDWIDTH_SAMPLE_TIME, leaving out any time spent paused or
+   * between transfers, and keep a moving average.
+   */
+  gint64 bandwidth_sample_start;  /* 0 when not sampling */
+  guint64 bandwidth_sample_bytes;
+  gdouble bandwidth;              /* Bits per second, 0 until known */
+  gint64 bandwidth_posted;        /* When the last message went out */
+
   /*
    * Response Headers
    */
@@ -235,6 +581,7 @@ struct _GstCurlHttpSrc
   gchar *content_type;
   guint status_code;
   gboolean hdrs_updated;
+  GstStructure *timing;         /* Set by the curl loop as a transfer ends */
 
   CURLcode curl_result;
   char curl_errbuf[CURL_ERROR_SIZE];
@@ -267,6 +614,21 @@ enum
   PROP_MAXCONCURRENT_PROXY,
   PROP_MAXCONCURRENT_GLOBAL,
   PROP_HTTPVERSION,
+  PROP_POOL_DEPTH,
+  PROP_MAX_BUFFER_BYTES,
+  PROP_HANDLE_POOL_STATS,
+  PROP_PARALLEL_RANGES,
+  PROP_PREFETCH_URIS,
+  PROP_RESPONSE_CACHE,
+  PROP_CACHE_DIRECTORY,
+  PROP_CACHE_DIRECTORY_SIZE,
+  PROP_REVALIDATE,
+  PROP_BANDWIDTH_ESTIMATE,
+  PROP_PRIORITY,
+  PROP_MAX_ACTIVE_TRANSFERS,
+  PROP_MAX_RATE,
+  PROP_MAX_HOST_RATE,
+  PROP_MAX_TOTAL_RATE,
   PROP_MAX
 };
 
@@ -274,5 +636,7 @@ curl_version_info_data *gst_curl_http_src_curl_capabilities;
 gfloat pref_http_ver;
 gchar *gst_curl_http_src_default_useragent;
 
+GType gst_curl_http_src_priority_get_type (void);
+
 G_END_DECLS
 #endif /* GSTCURLHTTPSRC_H_ */
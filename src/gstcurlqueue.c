@@ -45,84 +45,202 @@
 
 #include "gstcurlqueue.h"
 
+/*
+ * Link an element onto the tail of a queue.
+ */
+static void
+gst_curl_http_src_queue_link (GstCurlHttpSrcQueue * queue,
+    GstCurlHttpSrcQueueElement * qelement)
+{
+  qelement->queue = queue;
+  qelement->throttled_link.data = NULL;
+  qelement->throttled_link.prev = NULL;
+  qelement->throttled_link.next = NULL;
+  qelement->prev = queue->tail;
+  queue->class_length[qelement->priority]++;
+  qelement->next = NULL;
+  if (queue->tail == NULL) {
+    queue->head = qelement;
+  } else {
+    queue->tail->next = qelement;
+  }
+  queue->tail = qelement;
+  queue->length++;
+}
+
+/*
+ * Unlink an element from whichever queue it is currently on.
+ */
+static void
+gst_curl_http_src_queue_unlink (GstCurlHttpSrcQueueElement * qelement)
+{
+  GstCurlHttpSrcQueue *queue = qelement->queue;
+
+  gst_curl_http_src_unthrottle_queue_item (qelement);
+  if (qelement->prev == NULL) {
+    queue->head = qelement->next;
+  } else {
+    qelement->prev->next = qelement->next;
+  }
+  if (qelement->next == NULL) {
+    queue->tail = qelement->prev;
+  } else {
+    qelement->next->prev = qelement->prev;
+  }
+  queue->length--;
+  queue->class_length[qelement->priority]--;
+  qelement->queue = NULL;
+  qelement->prev = NULL;
+  qelement->next = NULL;
+}
+
 /**
- * Function to add an item to a queue. If the queue is empty (i.e. NULL), then
- * it creates the new head of the queue, otherwise it scans to the end and adds
- * the entry there.
- * @param queue The queue to add an item to. Can be NULL.
+ * Function to initialise an empty queue.
+ * @param queue The queue to initialise.
+ */
+void
+gst_curl_http_src_init_queue (GstCurlHttpSrcQueue * queue)
+{
+  queue->head = NULL;
+  queue->tail = NULL;
+  queue->length = 0;
+  memset (queue->class_length, 0, sizeof (queue->class_length));
+  g_queue_init (&queue->throttled);
+}
+
+/**
+ * Function to add an item to the tail of a queue.
+ * @param queue The queue to add an item to.
  * @param s The item to be added to the queue.
  * @return Returns TRUE (0) on success, FALSE (!0) is an error.
  */
 gboolean
-gst_curl_http_src_add_queue_item (GstCurlHttpSrcQueueElement ** queue,
+gst_curl_http_src_add_queue_item (GstCurlHttpSrcQueue * queue,
     GstCurlHttpSrc * s)
 {
-  GstCurlHttpSrcQueueElement *insert_point;
+  GstCurlHttpSrcQueueElement *qelement;
 
-  if (*queue == NULL) {
-    /* Queue is currently empty, so create a new item on the head */
-    *queue = (GstCurlHttpSrcQueueElement *)
-        g_malloc (sizeof (GstCurlHttpSrcQueueElement));
-    if (*queue == NULL) {
-      return FALSE;
-    }
-    insert_point = *queue;
+  qelement = (GstCurlHttpSrcQueueElement *)
+      g_malloc (sizeof (GstCurlHttpSrcQueueElement));
+  if (qelement == NULL) {
+    return FALSE;
+  }
+
+  qelement->p = s;
+  qelement->part = NULL;
+  qelement->handle = s->curl_handle;
+  qelement->followers = NULL;
+  qelement->priority = s->priority;
+  qelement->max_active = s->max_active_transfers;
+  gst_curl_http_src_queue_link (queue, qelement);
+  s->queue_element = qelement;
+  curl_easy_setopt (qelement->handle, CURLOPT_PRIVATE, qelement);
+  return TRUE;
+}
+
+/**
+ * Function to add one part of a parallel range download to the tail of a
+ * queue.
+ * @param queue The queue to add the part to.
+ * @param part The part to be added to the queue.
+ * @return Returns TRUE (0) on success, FALSE (!0) is an error.
+ */
+gboolean
+gst_curl_http_src_add_queue_part (GstCurlHttpSrcQueue * queue,
+    GstCurlHttpSrcPart * part)
+{
+  GstCurlHttpSrcQueueElement *qelement;
+
+  qelement = (GstCurlHttpSrcQueueElement *)
+      g_malloc (sizeof (GstCurlHttpSrcQueueElement));
+  if (qelement == NULL) {
+    return FALSE;
+  }
+
+  qelement->p = part->src;
+  qelement->part = part;
+  qelement->handle = part->handle;
+  qelement->followers = NULL;
+  /* Nobody is waiting on a prefetch yet, so it goes in with the bulk work */
+  if (part->uri != NULL) {
+    qelement->priority = GST_CURL_HTTP_SRC_PRIORITY_LOW;
   } else {
-    insert_point = *queue;
-    while (insert_point->next != NULL) {
-      insert_point = insert_point->next;
-    }
-    insert_point->next = (GstCurlHttpSrcQueueElement *)
-        g_malloc (sizeof (GstCurlHttpSrcQueueElement));
-    if (insert_point->next == NULL) {
-      return FALSE;
-    }
-    insert_point = insert_point->next;
+    qelement->priority = part->src->priority;
+  }
+  qelement->max_active = part->src->max_active_transfers;
+  gst_curl_http_src_queue_link (queue, qelement);
+  part->queue_element = qelement;
+  curl_easy_setopt (qelement->handle, CURLOPT_PRIVATE, qelement);
+  return TRUE;
+}
+
+/**
+ * Function to remove a part from whichever queue it is on.
+ * @param part The part to be removed.
+ * @return Returns TRUE if part removed, FALSE if it wasn't queued.
+ */
+gboolean
+gst_curl_http_src_remove_queue_part (GstCurlHttpSrcPart * part)
+{
+  GstCurlHttpSrcQueueElement *qelement = part->queue_element;
+
+  if (qelement == NULL) {
+    return FALSE;
   }
 
-  insert_point->p = s;
-  g_mutex_init (&insert_point->running);
-  insert_point->next = NULL;
+  gst_curl_http_src_queue_unlink (qelement);
+  part->queue_element = NULL;
+  g_free (qelement);
   return TRUE;
 }
 
 /**
- * Function to remove an item from a queue.
- * @param queue The queue to remove an item from.
+ * Function to find out whether an item can go on a queue without there being
+ * more items of its priority on there than it allows.
+ * @param queue The queue the item would go on.
+ * @param qelement The item.
+ * @return Returns TRUE if there's room for the item, FALSE if not.
+ */
+gboolean
+gst_curl_http_src_queue_has_room (GstCurlHttpSrcQueue * queue,
+    GstCurlHttpSrcQueueElement * qelement)
+{
+  return (qelement->max_active == 0) ||
+      (queue->class_length[qelement->priority] < qelement->max_active);
+}
+
+/**
+ * Function to move an item from the queue it is on to the tail of another,
+ * e.g. from the pending queue to the running queue.
+ * @param queue The queue to move the item on to.
+ * @param qelement The item to be moved.
+ */
+void
+gst_curl_http_src_move_queue_item (GstCurlHttpSrcQueue * queue,
+    GstCurlHttpSrcQueueElement * qelement)
+{
+  gst_curl_http_src_queue_unlink (qelement);
+  gst_curl_http_src_queue_link (queue, qelement);
+}
+
+/**
+ * Function to remove an item from whichever queue it is on. Anyone following
+ * the item must have been released first.
  * @param s The item to be removed.
- * @return Returns TRUE if item removed, FALSE if item couldn't be found.
+ * @return Returns TRUE if item removed, FALSE if it wasn't queued.
  */
 gboolean
-gst_curl_http_src_remove_queue_item (GstCurlHttpSrcQueueElement ** queue,
-    GstCurlHttpSrc * s)
+gst_curl_http_src_remove_queue_item (GstCurlHttpSrc * s)
 {
-  GstCurlHttpSrcQueueElement *prev_qelement, *this_qelement;
+  GstCurlHttpSrcQueueElement *qelement = s->queue_element;
 
-  prev_qelement = NULL;
-  this_qelement = *queue;
-  while (this_qelement->p != s) {
-    if (this_qelement == NULL) {
-      /* Reached end of list without finding anything */
-      return FALSE;
-    }
-    prev_qelement = this_qelement;
-    this_qelement = this_qelement->next;
-  }
-
-  /* First queue item matched. */
-  if (prev_qelement == NULL) {
-    /* First and only element? If so, free the element and make queue NULL */
-    if (this_qelement->next == NULL) {
-      g_free (*queue);
-      *queue = NULL;
-      return TRUE;
-    } else {
-      *queue = this_qelement->next;
-    }
-  } else {
-    prev_qelement->next = this_qelement->next;
+  if (qelement == NULL) {
+    return FALSE;
   }
-  g_free (this_qelement);
+
+  gst_curl_http_src_queue_unlink (qelement);
+  s->queue_element = NULL;
+  g_free (qelement);
   return TRUE;
 }
 
@@ -132,54 +250,241 @@ gst_curl_http_src_remove_queue_item (GstCurlHttpSrcQueueElement ** queue,
  * returns, so it's safe to assume that the transfer completed and the result
  * can be set as GSTCURL_RETURN_DONE (which doesn't necessarily mean that the
  * transfer was a success, just that CURL is finished with it)
- * @param queue The queue to remove an item from.
- * @param s The item to be removed.
+ * @param handle The curl handle of the item to be removed.
+ * @param result The result curl gave for the transfer.
  * @return Returns TRUE if item removed, FALSE if item couldn't be found.
  */
 gboolean
-gst_curl_http_src_remove_queue_handle (GstCurlHttpSrcQueueElement ** queue,
-    CURL * handle, CURLcode result)
+gst_curl_http_src_remove_queue_handle (CURL * handle, CURLcode result)
 {
-  GstCurlHttpSrcQueueElement *prev_qelement, *this_qelement;
+  GstCurlHttpSrcQueueElement *qelement = NULL;
+  GstCurlHttpSrc *s;
 
-  prev_qelement = NULL;
-  this_qelement = *queue;
-  while (this_qelement->p->curl_handle != handle) {
-    if (this_qelement == NULL) {
-      /* Reached end of list without finding anything */
-      return FALSE;
-    }
-    prev_qelement = this_qelement;
-    this_qelement = this_qelement->next;
+  /* The queue element is stashed in the handle when it's queued */
+  if ((curl_easy_getinfo (handle, CURLINFO_PRIVATE,
+              (char **) &qelement) != CURLE_OK) || (qelement == NULL)) {
+    return FALSE;
+  }
+  s = qelement->p;
+
+  if (qelement->part != NULL) {
+    GstCurlHttpSrcPart *part = qelement->part;
+
+    /* The owner is free to get rid of the part as soon as it's marked done */
+    gst_curl_http_src_remove_queue_part (part);
+    g_mutex_lock (&s->buffer_mutex);
+    part->done = TRUE;
+    part->result = result;
+    g_cond_signal (&s->signal);
+    g_mutex_unlock (&s->buffer_mutex);
+    return TRUE;
   }
 
-  /*GST_DEBUG_OBJECT (this_qelement->p,
-     "Removing queue item via curl handle for URI %s",
-     this_qelement->p->uri); */
+  /*GST_DEBUG_OBJECT (s, "Removing queue item via curl handle for URI %s",
+     s->uri); */
   /* First, signal the transfer owner thread to wake up */
-  g_mutex_lock (&this_qelement->p->buffer_mutex);
-  g_cond_signal (&this_qelement->p->signal);
-  if (this_qelement->p->state != GSTCURL_UNLOCK) {
-    this_qelement->p->state = GSTCURL_DONE;
+  g_mutex_lock (&s->buffer_mutex);
+  g_cond_signal (&s->signal);
+  if (s->state != GSTCURL_UNLOCK) {
+    s->state = GSTCURL_DONE;
   } else {
-    this_qelement->p->pending_state = GSTCURL_DONE;
-  }
-  this_qelement->p->curl_result = result;
-  g_mutex_unlock (&this_qelement->p->buffer_mutex);
-
-  /* First queue item matched. */
-  if (prev_qelement == NULL) {
-    /* First and only element? If so, free the element and make queue NULL */
-    if (this_qelement->next == NULL) {
-      g_free (*queue);
-      *queue = NULL;
-      return TRUE;
-    } else {
-      *queue = this_qelement->next;
-    }
+    s->pending_state = GSTCURL_DONE;
+  }
+  s->curl_result = result;
+  g_mutex_unlock (&s->buffer_mutex);
+
+  /* Anyone following the transfer has had everything we have */
+  gst_curl_http_src_release_followers (qelement, result);
+  return gst_curl_http_src_remove_queue_item (s);
+}
+
+/**
+ * Function to note that shaping has paused an item, so that the curl loop
+ * carries it on once there's bandwidth for it again. Called with the context
+ * mutex held.
+ * @param qelement The item that has been paused.
+ */
+void
+gst_curl_http_src_throttle_queue_item (GstCurlHttpSrcQueueElement * qelement)
+{
+  if ((qelement->queue != NULL) && (qelement->throttled_link.data == NULL)) {
+    qelement->throttled_link.data = qelement;
+    g_queue_push_tail_link (&qelement->queue->throttled,
+        &qelement->throttled_link);
+  }
+}
+
+/**
+ * Function to note that an item is no longer paused by shaping, if it was.
+ * Called with the context mutex held.
+ * @param qelement The item.
+ */
+void
+gst_curl_http_src_unthrottle_queue_item (GstCurlHttpSrcQueueElement * qelement)
+{
+  if (qelement->throttled_link.data != NULL) {
+    g_queue_unlink (&qelement->queue->throttled, &qelement->throttled_link);
+    qelement->throttled_link.data = NULL;
+  }
+}
+
+/*
+ * Finish off the transfer of a source that was following someone else's.
+ */
+static void
+gst_curl_http_src_finish_follower (GstCurlHttpSrc * s, CURLcode result)
+{
+  g_mutex_lock (&s->buffer_mutex);
+  if ((result == CURLE_OK) && (s->status_code == 0)) {
+    /* Without a response of its own, s has to go and ask for itself */
+    result = CURLE_PARTIAL_FILE;
+  }
+  if (s->state != GSTCURL_UNLOCK) {
+    s->state = GSTCURL_DONE;
   } else {
-    prev_qelement->next = this_qelement->next;
+    s->pending_state = GSTCURL_DONE;
   }
-  g_free (this_qelement);
-  return TRUE;
+  s->curl_result = result;
+  g_cond_signal (&s->signal);
+  g_mutex_unlock (&s->buffer_mutex);
+}
+
+/*
+ * Whether two sources would send exactly the same request, by the same route
+ * and trusting the same servers.
+ */
+static gboolean
+gst_curl_http_src_same_request (GstCurlHttpSrc * a, GstCurlHttpSrc * b)
+{
+  if ((a->request_headers == NULL) != (b->request_headers == NULL)) {
+    return FALSE;
+  }
+  if ((a->request_headers != NULL) &&
+      (gst_structure_is_equal (a->request_headers,
+              b->request_headers) == FALSE)) {
+    return FALSE;
+  }
+  return (g_strcmp0 (a->uri, b->uri) == 0) &&
+      (g_strcmp0 (a->user_agent, b->user_agent) == 0) &&
+      (g_strcmp0 (a->username, b->username) == 0) &&
+      (g_strcmp0 (a->password, b->password) == 0) &&
+      (g_strcmp0 (a->proxy_uri, b->proxy_uri) == 0) &&
+      (g_strcmp0 (a->no_proxy_list, b->no_proxy_list) == 0) &&
+      (g_strcmp0 (a->proxy_user, b->proxy_user) == 0) &&
+      (g_strcmp0 (a->proxy_pass, b->proxy_pass) == 0) &&
+      (a->allow_3xx_redirect == b->allow_3xx_redirect) &&
+      (a->max_3xx_redirects == b->max_3xx_redirects) &&
+      (a->strict_ssl == b->strict_ssl) &&
+      (g_strcmp0 (a->custom_ca_file, b->custom_ca_file) == 0) &&
+      (a->number_cookies == 0) && (b->number_cookies == 0) &&
+      (a->accept_compressed_encodings == b->accept_compressed_encodings) &&
+      (a->preferred_http_version == b->preferred_http_version);
+}
+
+/**
+ * Function to have s share a transfer that's already queued or running for
+ * the same request, instead of making its own. Only a transfer of the whole
+ * resource that hasn't yet had any response can be followed, so that the
+ * follower sees all of it, headers and all. Once following, s is handed each
+ * header line and chunk of body the transfer's owner gets, and is finished
+ * when the transfer is. Called with the context mutex held.
+ * @param context The context s is about to queue its transfer on.
+ * @param s The source wanting to make a request.
+ * @return Returns TRUE if s is now following a transfer, FALSE if it should
+ * make its own.
+ */
+gboolean
+gst_curl_http_src_follow_queue_item (GstCurlHttpSrcMultiTaskContext * context,
+    GstCurlHttpSrc * s)
+{
+  GstCurlHttpSrcQueue *queues[] = { &context->queue, &context->pending_queue };
+  GstCurlHttpSrcQueueElement *qelement;
+  GstCurlHttpSrc *leader;
+  gboolean joinable;
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (queues); i++) {
+    for (qelement = queues[i]->head; qelement != NULL;
+        qelement = qelement->next) {
+      leader = qelement->p;
+      if ((qelement->part != NULL) || (leader == s) ||
+          (gst_curl_http_src_same_request (leader, s) == FALSE)) {
+        continue;
+      }
+
+      /* A conditional request might not get the whole thing back */
+      g_mutex_lock (&leader->buffer_mutex);
+      joinable = (leader->state == GSTCURL_OK) &&
+          (leader->status_code == 0) && (leader->data_received == FALSE) &&
+          (leader->request_position == 0) && (leader->transfer_stop == -1) &&
+          (leader->stale_body == NULL);
+      if (joinable == TRUE) {
+        leader->followed = TRUE;
+      }
+      g_mutex_unlock (&leader->buffer_mutex);
+
+      if (joinable == TRUE) {
+        qelement->followers = g_slist_append (qelement->followers, s);
+        s->following = qelement;
+        return TRUE;
+      }
+    }
+  }
+  return FALSE;
+}
+
+/**
+ * Function to stop s following the transfer it's sharing, if it is. The
+ * caller is left to decide how s's own transfer ends. Called with the context
+ * mutex held, but not s's buffer_mutex.
+ * @param s The source to detach.
+ */
+void
+gst_curl_http_src_unfollow_queue_item (GstCurlHttpSrc * s)
+{
+  GstCurlHttpSrcQueueElement *qelement = s->following;
+  GstCurlHttpSrc *leader;
+
+  if (qelement == NULL) {
+    return;
+  }
+
+  leader = qelement->p;
+  qelement->followers = g_slist_remove (qelement->followers, s);
+  s->following = NULL;
+  g_mutex_lock (&leader->buffer_mutex);
+  leader->followed = (qelement->followers != NULL);
+  g_mutex_unlock (&leader->buffer_mutex);
+}
+
+/**
+ * Function to finish the transfers of everyone following qelement. This has
+ * to happen before the item is removed from its queue. Called with the
+ * context mutex held, but no buffer_mutex.
+ * @param qelement The item whose transfer is over.
+ * @param result The result each follower should see for its transfer.
+ */
+void
+gst_curl_http_src_release_followers (GstCurlHttpSrcQueueElement * qelement,
+    CURLcode result)
+{
+  GSList *followers = qelement->followers;
+  GSList *link;
+
+  if (followers == NULL) {
+    return;
+  }
+
+  qelement->followers = NULL;
+  g_mutex_lock (&qelement->p->buffer_mutex);
+  qelement->p->followed = FALSE;
+  g_mutex_unlock (&qelement->p->buffer_mutex);
+
+  for (link = followers; link != NULL; link = link->next) {
+    GstCurlHttpSrc *follower = link->data;
+
+    follower->following = NULL;
+    gst_curl_http_src_finish_follower (follower, result);
+  }
+  g_slist_free (followers);
 }
@@ -48,18 +48,47 @@
 
 #include "gstcurlhttpsrc.h"
 
+/*
+ * Queue elements are linked in both directions and know which queue they are
+ * on, so that they can be unlinked without searching. The owning
+ * GstCurlHttpSrc (or part) points back at its element, and the easy handle at
+ * the element through CURLOPT_PRIVATE, so lookups don't search either.
+ */
 struct _GstCurlHttpSrcQueueElement
 {
   GstCurlHttpSrc *p;
-  GMutex running;
+  GstCurlHttpSrcPart *part;     /* NULL for the GstCurlHttpSrc's own transfer */
+  CURL *handle;
+  GstCurlHttpSrcQueue *queue;
+  GstCurlHttpSrcQueueElement *prev;
   GstCurlHttpSrcQueueElement *next;
+  GSList *followers;            /* GstCurlHttpSrc sharing this transfer */
+  GstCurlHttpSrcPriority priority;
+  guint max_active;             /* Of its priority, to be let on; 0 for any */
+  GList throttled_link;         /* In its queue's throttled, data NULL if not */
 };
 
-gboolean gst_curl_http_src_add_queue_item (GstCurlHttpSrcQueueElement **queue,
+void gst_curl_http_src_init_queue (GstCurlHttpSrcQueue *queue);
+gboolean gst_curl_http_src_add_queue_item (GstCurlHttpSrcQueue *queue,
     GstCurlHttpSrc *s);
-gboolean gst_curl_http_src_remove_queue_item (
-    GstCurlHttpSrcQueueElement **queue, GstCurlHttpSrc *s);
-gboolean gst_curl_http_src_remove_queue_handle (
-    GstCurlHttpSrcQueueElement **queue, CURL *handle, CURLcode result);
+gboolean gst_curl_http_src_queue_has_room (GstCurlHttpSrcQueue *queue,
+    GstCurlHttpSrcQueueElement *qelement);
+void gst_curl_http_src_move_queue_item (GstCurlHttpSrcQueue *queue,
+    GstCurlHttpSrcQueueElement *qelement);
+gboolean gst_curl_http_src_remove_queue_item (GstCurlHttpSrc *s);
+gboolean gst_curl_http_src_add_queue_part (GstCurlHttpSrcQueue *queue,
+    GstCurlHttpSrcPart *part);
+gboolean gst_curl_http_src_remove_queue_part (GstCurlHttpSrcPart *part);
+gboolean gst_curl_http_src_remove_queue_handle (CURL *handle,
+    CURLcode result);
+void gst_curl_http_src_throttle_queue_item (
+    GstCurlHttpSrcQueueElement *qelement);
+void gst_curl_http_src_unthrottle_queue_item (
+    GstCurlHttpSrcQueueElement *qelement);
+gboolean gst_curl_http_src_follow_queue_item (
+    GstCurlHttpSrcMultiTaskContext *context, GstCurlHttpSrc *s);
+void gst_curl_http_src_unfollow_queue_item (GstCurlHttpSrc *s);
+void gst_curl_http_src_release_followers (
+    GstCurlHttpSrcQueueElement *qelement, CURLcode result);
 
 #endif /* GSTCURLQUEUE_H_ */